@@ -226,6 +226,8 @@ float DirectionalLightShadow(vec3 pos, vec3 normalDir, vec3 lightDir)
 uniform samplerCube u_heightmap;
 uniform samplerCube u_normal;
 uniform samplerCube u_splatmap;
+uniform samplerCube u_materialmap;
+uniform samplerCube u_horizonmap;
 uniform sampler2D u_water_normalmap;
 uniform sampler2D u_terrain_textures[4];
 
@@ -237,6 +239,9 @@ uniform vec3 u_water_deep_color;
 uniform float u_water_speed;
 uniform float u_water_scale;
 uniform float u_terrain_texture_scales[4];
+uniform float u_shadow_softness;
+uniform float u_ambient_occlusion;
+uniform float u_two_material_splat;
 
 in vec3 ModelPos;
 in vec3 Pos;
@@ -296,7 +301,7 @@ vec2 StochasticTilingHash(vec2 x)
     return fract(sin((x) * mat2(127.1, 311.7, 269.5, 183.3) )*43758.5453);
 }
 
-vec4 SampleStochastic(sampler2D tex, vec2 uv)
+vec4 SampleStochasticGrad(sampler2D tex, vec2 uv, vec2 duvdx, vec2 duvdy)
 {
     // Get triangle info
     float w1, w2, w3;
@@ -308,10 +313,6 @@ vec4 SampleStochastic(sampler2D tex, vec2 uv)
     vec2 uv2 = uv + StochasticTilingHash(vertex2);
     vec2 uv3 = uv + StochasticTilingHash(vertex3);
 
-    // Precompute UV derivatives 
-    vec2 duvdx = dFdx(uv);
-    vec2 duvdy = dFdy(uv);
-
     // Fetch Gaussian input
     vec4 G1 = textureGrad(tex, uv1, duvdx, duvdy);
     vec4 G2 = textureGrad(tex, uv2, duvdx, duvdy);
@@ -326,16 +327,25 @@ vec4 SampleStochastic(sampler2D tex, vec2 uv)
     return color;
 }
 
-vec4 SampleTriplanar(
+vec4 SampleStochastic(sampler2D tex, vec2 uv)
+{
+    return SampleStochasticGrad(tex, uv, dFdx(uv), dFdy(uv));
+}
+
+/*
+Derivatives are passed in so the sample is also valid in non-uniform
+control flow, where dFdx and dFdy are undefined.
+*/
+vec4 SampleTriplanarGrad(
     sampler2D tex,
-    vec2 xy,
-    vec2 yz,
-    vec2 zx,
+    vec3 position,
+    vec3 dpdx,
+    vec3 dpdy,
     vec3 normal)
 {
-    vec4 xy_sample = pow(SampleStochastic(tex, xy), vec4(2.2));
-    vec4 yz_sample = pow(SampleStochastic(tex, yz), vec4(2.2));
-    vec4 zx_sample = pow(SampleStochastic(tex, zx), vec4(2.2));
+    vec4 xy_sample = pow(SampleStochasticGrad(tex, position.xy, dpdx.xy, dpdy.xy), vec4(2.2));
+    vec4 yz_sample = pow(SampleStochasticGrad(tex, position.yz, dpdx.yz, dpdy.yz), vec4(2.2));
+    vec4 zx_sample = pow(SampleStochasticGrad(tex, position.zx, dpdx.zx, dpdy.zx), vec4(2.2));
     
     vec3 weights = pow(abs(normal), vec3(2.0));
     weights /= (weights.x + weights.y + weights.z);
@@ -346,31 +356,73 @@ vec4 SampleTriplanar(
         weights.z * xy_sample);
 }
 
+/* Sampler arrays only take constant indices in GLSL 330 */
+vec4 SampleMaterial(int index, vec3 position, vec3 dpdx, vec3 dpdy, vec3 normal)
+{
+    if (index == 0)
+    {
+        float scale = u_terrain_texture_scales[0];
+        return SampleTriplanarGrad(u_terrain_textures[0], scale * position, scale * dpdx, scale * dpdy, normal);
+    }
+    if (index == 1)
+    {
+        float scale = u_terrain_texture_scales[1];
+        return SampleTriplanarGrad(u_terrain_textures[1], scale * position, scale * dpdx, scale * dpdy, normal);
+    }
+    if (index == 2)
+    {
+        float scale = u_terrain_texture_scales[2];
+        return SampleTriplanarGrad(u_terrain_textures[2], scale * position, scale * dpdx, scale * dpdy, normal);
+    }
+    float scale = u_terrain_texture_scales[3];
+    return SampleTriplanarGrad(u_terrain_textures[3], scale * position, scale * dpdx, scale * dpdy, normal);
+}
+
+/*
+Moves a direction to the center of the cubemap texel it falls in, so a
+filtered fetch returns that texel alone. Material indices must not be
+interpolated between texels.
+*/
+vec3 SnapToTexelCenter(vec3 direction, float resolution)
+{
+    vec3 magnitude = abs(direction);
+    float major = max(magnitude.x, max(magnitude.y, magnitude.z));
+    vec3 point = direction / major;
+    vec3 texel = min(floor((0.5 * point + 0.5) * resolution), resolution - 1.0);
+    vec3 snapped = 2.0 * (texel + 0.5) / resolution - 1.0;
+    return mix(snapped, point, equal(magnitude, vec3(major)));
+}
+
 vec4 SampleTerrain(vec3 position)
 {
     vec4 splat_weights = texture(u_splatmap, position);
 
     vec3 normal = normalize(position);
+    vec3 dpdx = dFdx(position);
+    vec3 dpdy = dFdy(position);
 
-    vec2 xy = position.xy;
-    vec2 yz = position.yz;
-    vec2 zx = position.zx;
-
-    float scale = u_terrain_texture_scales[0];
-    vec4 sample0 = SampleTriplanar(
-        u_terrain_textures[0], scale*xy, scale*yz, scale*zx, normal);
+    // Only the two heaviest materials of the texel are sampled
+    if (u_two_material_splat > 0.5)
+    {
+        float resolution = float(textureSize(u_materialmap, 0).x);
+        vec3 materials = texture(u_materialmap, SnapToTexelCenter(position, resolution)).xyz;
+        int first = int(3.0 * materials.x + 0.5);
+        int second = int(3.0 * materials.y + 0.5);
+
+        // The filtered splat keeps the blend smooth within the texel
+        float first_weight = splat_weights[first];
+        float kept = first_weight + splat_weights[second];
+        float share = kept > 1.0e-4 ? first_weight / kept : materials.z;
+
+        vec4 first_sample = SampleMaterial(first, position, dpdx, dpdy, normal);
+        vec4 second_sample = SampleMaterial(second, position, dpdx, dpdy, normal);
+        return mix(second_sample, first_sample, share);
+    }
 
-    scale = u_terrain_texture_scales[1];
-    vec4 sample1 = SampleTriplanar(
-        u_terrain_textures[1], scale*xy, scale*yz, scale*zx, normal);
-        
-    scale = u_terrain_texture_scales[2];
-    vec4 sample2 = SampleTriplanar(
-        u_terrain_textures[2], scale*xy, scale*yz, scale*zx, normal);
-    
-    scale = u_terrain_texture_scales[3];
-    vec4 sample3 = SampleTriplanar(
-        u_terrain_textures[3], scale*xy, scale*yz, scale*zx, normal);
+    vec4 sample0 = SampleMaterial(0, position, dpdx, dpdy, normal);
+    vec4 sample1 = SampleMaterial(1, position, dpdx, dpdy, normal);
+    vec4 sample2 = SampleMaterial(2, position, dpdx, dpdy, normal);
+    vec4 sample3 = SampleMaterial(3, position, dpdx, dpdy, normal);
 
     return (
         sample0 * splat_weights.x +
@@ -424,6 +476,35 @@ vec3 SampleWaterNormal(sampler2D tex, vec3 pos)
         weights.z * z_normal.xyz);
 }
 
+//////////////////////////////
+// HORIZON MAP
+//////////////////////////////
+/* Must match HorizonTangentFrame in horizon.hpp */
+void HorizonTangentFrame(vec3 direction, out vec3 east, out vec3 north)
+{
+    vec3 up = abs(direction.y) < 0.999 ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0);
+    east = normalize(cross(up, direction));
+    north = cross(direction, east);
+}
+
+/*
+Soft self shadowing from the baked horizon.
+The horizon toward the light is rebuilt from its first harmonics and the
+light is faded in as its elevation clears it. Directions are in model space.
+*/
+float HorizonShadow(vec4 horizon, vec3 direction, vec3 lightDir)
+{
+    vec3 east, north;
+    HorizonTangentFrame(direction, east, north);
+
+    vec2 azimuth = vec2(dot(lightDir, east), dot(lightDir, north));
+    azimuth /= max(length(azimuth), 1.0e-6);
+    float sinHorizon = horizon.y + dot(2.0 * horizon.zw - 1.0, azimuth);
+    float sinElevation = dot(lightDir, direction);
+
+    return smoothstep(sinHorizon - u_shadow_softness, sinHorizon + u_shadow_softness, sinElevation);
+}
+
 //////////////////////////////
 // MAIN
 //////////////////////////////
@@ -432,6 +513,8 @@ void main()
     float height = texture(u_heightmap, ModelPos).x;
     float blend = smoothstep(-1.0, 0.0, (height - u_water_level) / u_water_depth_scale);
     float mask = height >= u_water_level ? 1.0 : 0.0;
+    vec3 direction = normalize(ModelPos);
+    vec4 horizon = texture(u_horizonmap, ModelPos);
 
     vec3 water_normal = u_NormalMatrix * SampleWaterNormal(u_water_normalmap, ModelPos);
     water_normal = normalize((1.0 - blend) * water_normal + blend * Normal);
@@ -460,8 +543,11 @@ void main()
     }
     for (int i=0; i < u_nDirectionalLights; i++)
     {
-        float shadow = dot(-u_directionalLights[i].direction, surface.position) > 0.0 ? 1.0 : 0.0;
-        //float shadow = i==0 ? DirectionalLightShadow(surface.position, surface.normal, -u_directionalLights[i].direction) : 1.0;
+        // Water is flat at the water level, so it only keeps the hemisphere test.
+        // Land keeps it too, the soft horizon fade still lets light through at zero elevation
+        float hemisphere = dot(-u_directionalLights[i].direction, surface.position) > 0.0 ? 1.0 : 0.0;
+        vec3 lightDir = normalize(transpose(u_NormalMatrix) * -u_directionalLights[i].direction);
+        float shadow = hemisphere * mix(1.0, HorizonShadow(horizon, direction, lightDir), mask);
         result += shadow * DirectionalLightReflectedRadiance(u_directionalLights[i], surface);
     }
     for (int i = 0; i < u_nSpotLights; i++)
@@ -469,7 +555,8 @@ void main()
         result += SpotLightReflectedRadiance(u_spotLights[i], surface);
     }
 
-    result += vec3(u_ambientRadiance) * surface.albedo;
+    float occlusion = mix(1.0, horizon.x, mask * u_ambient_occlusion);
+    result += vec3(u_ambientRadiance) * surface.albedo * occlusion;
     
     // HDR Tonemap and gamma correction
     result = result / (result + vec3(1.0));
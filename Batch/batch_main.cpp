@@ -0,0 +1,282 @@
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "batch.hpp"
+#include "distributed.hpp"
+#include "parallel.hpp"
+
+
+static void PrintUsage()
+{
+    std::printf(
+        "Usage: ProceduralTerrainBatch <manifest> [options]\n"
+        "  --output=directory      Write height/normal/splat (and flow/lake) cubemaps per planet\n"
+        "  --format=raw            Output format: raw, png (16 bit) or exr\n"
+        "  --equirect=W            Also write W x W/2 equirectangular panoramas\n"
+        "  --memory-budget-mb=4096 Cap on cubemap memory held by planets in flight\n"
+        "  --max-in-flight=N       Cap on planets generated concurrently\n"
+        "  --threads=N             Worker threads used by each pass\n"
+        "\n"
+        "Sharded generation, heights, normals and biomes are generated by worker processes:\n"
+        "  --coordinator=PORT      Serve tile jobs to workers connecting on PORT\n"
+        "  --workers=N[,N...]      Spawn N local workers, once per count, and report scaling\n"
+        "  --worker-threads=1      Threads used by each spawned worker\n"
+        "  --tile-size=128         Texels per side of one tile job\n"
+        "  --wait-workers=N        Wait for N workers to connect before starting\n"
+        "Usage: ProceduralTerrainBatch --worker=HOST:PORT [--threads=N]\n");
+}
+
+static void PrintReport(const BatchReport& report)
+{
+    double pool_capacity = report.wall_seconds * report.pool_threads;
+
+    std::printf("\nPlanets completed   %d\n", report.planets_completed);
+    std::printf("Wall time           %.2f s\n", report.wall_seconds);
+    std::printf("Planets per hour    %.1f\n", report.PlanetsPerHour());
+    std::printf("Peak planet memory  %.1f MB\n", report.peak_memory_bytes / (1024.0 * 1024.0));
+    std::printf("Arena high water    %.1f MB\n", report.arena_high_water_bytes / (1024.0 * 1024.0));
+    std::printf(
+        "Pool utilization    %.1f%% of %d threads\n",
+        pool_capacity > 0.0 ? 100.0 * report.pool_busy_seconds / pool_capacity : 0.0,
+        report.pool_threads);
+
+    std::printf("\n%-12s %8s %12s %12s\n", "Stage", "Runs", "Busy s", "Utilization");
+    for (size_t k = 0; k < report.stages.size(); ++k)
+    {
+        const auto& stage = report.stages[k];
+        std::printf(
+            "%-12s %8d %12.2f %11.1f%%\n",
+            PlanetStageName(static_cast<PlanetStage>(k)),
+            stage.runs,
+            stage.busy_seconds,
+            pool_capacity > 0.0 ? 100.0 * stage.busy_seconds / pool_capacity : 0.0);
+    }
+}
+
+static void PrintCoordinatorReport(const CoordinatorReport& report)
+{
+    std::printf("\nWorkers connected   %d (peak %d, lost %d)\n", report.workers_connected, report.peak_workers, report.workers_lost);
+    std::printf(
+        "Tiles               %llu (%llu requeued, %llu generated locally)\n",
+        static_cast<unsigned long long>(report.tiles_completed),
+        static_cast<unsigned long long>(report.tiles_requeued),
+        static_cast<unsigned long long>(report.tiles_generated_locally));
+    std::printf("Tile data received  %.1f MB\n", report.bytes_received / (1024.0 * 1024.0));
+    std::printf("Tile phase          %.2f s\n", report.active_seconds);
+    std::printf("Worker efficiency   %.1f%%\n", 100.0 * report.ScalingEfficiency());
+}
+
+static std::vector<int> ParseCounts(const std::string& text)
+{
+    std::vector<int> counts;
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+        int count = std::atoi(item.c_str());
+        if (count > 0)
+            counts.push_back(count);
+    }
+    return counts;
+}
+
+static int RunWorker(const std::string& address)
+{
+    auto separator = address.rfind(':');
+    if (separator == std::string::npos)
+    {
+        PrintUsage();
+        return 1;
+    }
+    std::string error;
+    if (!RunTileWorker(address.substr(0, separator), std::atoi(address.substr(separator + 1).c_str()), error))
+    {
+        std::printf("%s\n", error.c_str());
+        return 1;
+    }
+    return 0;
+}
+
+struct ScalingRun
+{
+    int workers = 0;
+    BatchReport batch;
+    CoordinatorReport tiles;
+};
+
+/*
+Runs the batch once per worker count with freshly spawned local workers.
+Speedup and efficiency are taken over the tile phase relative to the first
+count, since the stages left on the coordinator do not scale with workers.
+*/
+static int RunScalingSweep(
+    const std::string& executable,
+    const std::vector<PlanetConfig>& planets,
+    BatchSettings settings,
+    const CoordinatorSettings& coordinator_settings,
+    const std::vector<int>& worker_counts,
+    int worker_threads)
+{
+    std::vector<ScalingRun> runs;
+    for (int count : worker_counts)
+    {
+        ScalingRun run;
+        run.workers = count;
+        std::vector<std::thread> workers;
+        {
+            TileCoordinator coordinator(coordinator_settings);
+            std::string error;
+            if (!coordinator.Start(error))
+            {
+                std::printf("%s\n", error.c_str());
+                return 1;
+            }
+
+            std::string command =
+                "\"" + executable + "\" --worker=127.0.0.1:" + std::to_string(coordinator.GetPort()) +
+                " --threads=" + std::to_string(worker_threads);
+            for (int k = 0; k < count; ++k)
+                workers.emplace_back([command]() { std::system(command.c_str()); });
+
+            std::printf("\nGenerating %d planet(s) on %d worker(s)\n", static_cast<int>(planets.size()), count);
+            if (!coordinator.WaitForWorkers(count, 30.0))
+                std::printf("Not all workers connected, continuing with those that did\n");
+            settings.coordinator = &coordinator;
+            run.batch = RunPlanetBatch(planets, settings);
+            run.tiles = coordinator.GetReport();
+        }
+
+        // Destroying the coordinator shut the workers down
+        for (auto& worker : workers)
+            worker.join();
+        PrintCoordinatorReport(run.tiles);
+        runs.push_back(run);
+    }
+
+    const auto& base = runs.front();
+    std::printf("\n%-8s %10s %10s %10s %11s\n", "Workers", "Wall s", "Tiles s", "Speedup", "Efficiency");
+    for (const auto& run : runs)
+    {
+        double speedup = run.tiles.active_seconds > 0.0 ? base.tiles.active_seconds / run.tiles.active_seconds : 0.0;
+        std::printf(
+            "%-8d %10.2f %10.2f %9.2fx %10.1f%%\n",
+            run.workers,
+            run.batch.wall_seconds,
+            run.tiles.active_seconds,
+            speedup,
+            100.0 * speedup * base.workers / run.workers);
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    std::string first_argument = argv[1];
+    if (first_argument.rfind("--worker=", 0) == 0)
+    {
+        for (int k = 2; k < argc; ++k)
+        {
+            std::string argument = argv[k];
+            if (argument.rfind("--threads=", 0) == 0)
+                SetWorkerThreadCount(std::atoi(argument.substr(10).c_str()));
+        }
+        return RunWorker(first_argument.substr(9));
+    }
+
+    std::string manifest_path = argv[1];
+    BatchSettings settings;
+    CoordinatorSettings coordinator_settings;
+    bool coordinate = false;
+    int wait_workers = 0;
+    int worker_threads = 1;
+    std::vector<int> worker_counts;
+    for (int k = 2; k < argc; ++k)
+    {
+        std::string argument = argv[k];
+        auto value_of = [&argument](const std::string& key) {
+            return argument.substr(key.size());
+        };
+
+        if (argument.rfind("--output=", 0) == 0)
+            settings.output_directory = value_of("--output=");
+        else if (argument == "--format=png" || argument == "--format=exr")
+        {
+            settings.export_images = true;
+            settings.image_format = argument == "--format=png" ? ImageFormat::Png16 : ImageFormat::Exr;
+        }
+        else if (argument == "--format=raw")
+            settings.export_images = false;
+        else if (argument.rfind("--equirect=", 0) == 0)
+            settings.equirectangular_width = std::atoi(value_of("--equirect=").c_str());
+        else if (argument.rfind("--memory-budget-mb=", 0) == 0)
+            settings.memory_budget_bytes = uint64_t(std::atoll(value_of("--memory-budget-mb=").c_str())) << 20;
+        else if (argument.rfind("--max-in-flight=", 0) == 0)
+            settings.max_planets_in_flight = std::atoi(value_of("--max-in-flight=").c_str());
+        else if (argument.rfind("--threads=", 0) == 0)
+            SetWorkerThreadCount(std::atoi(value_of("--threads=").c_str()));
+        else if (argument.rfind("--coordinator=", 0) == 0)
+        {
+            coordinate = true;
+            coordinator_settings.port = std::atoi(value_of("--coordinator=").c_str());
+        }
+        else if (argument.rfind("--workers=", 0) == 0)
+            worker_counts = ParseCounts(value_of("--workers="));
+        else if (argument.rfind("--worker-threads=", 0) == 0)
+            worker_threads = std::atoi(value_of("--worker-threads=").c_str());
+        else if (argument.rfind("--tile-size=", 0) == 0)
+            coordinator_settings.tile_size = std::atoi(value_of("--tile-size=").c_str());
+        else if (argument.rfind("--wait-workers=", 0) == 0)
+            wait_workers = std::atoi(value_of("--wait-workers=").c_str());
+        else
+        {
+            PrintUsage();
+            return 1;
+        }
+    }
+
+    std::vector<PlanetConfig> planets;
+    std::string error;
+    if (!ReadPlanetManifest(manifest_path, planets, error))
+    {
+        std::printf("%s\n", error.c_str());
+        return 1;
+    }
+    if (!settings.output_directory.empty())
+        std::filesystem::create_directories(settings.output_directory);
+
+    if (!worker_counts.empty())
+        return RunScalingSweep(argv[0], planets, settings, coordinator_settings, worker_counts, worker_threads);
+
+    std::unique_ptr<TileCoordinator> coordinator = nullptr;
+    if (coordinate)
+    {
+        coordinator = std::make_unique<TileCoordinator>(coordinator_settings);
+        if (!coordinator->Start(error))
+        {
+            std::printf("%s\n", error.c_str());
+            return 1;
+        }
+        std::printf("Coordinator listening on port %d\n", coordinator->GetPort());
+        if (wait_workers > 0 && !coordinator->WaitForWorkers(wait_workers, 600.0))
+            std::printf("Not all workers connected, continuing with those that did\n");
+        settings.coordinator = coordinator.get();
+    }
+
+    std::printf("Generating %d planet(s)\n", static_cast<int>(planets.size()));
+    auto report = RunPlanetBatch(planets, settings);
+    PrintReport(report);
+    if (coordinator != nullptr)
+        PrintCoordinatorReport(coordinator->GetReport());
+    return 0;
+}
@@ -0,0 +1,917 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <glm/gtc/constants.hpp>
+#include "terrain.hpp"
+#include "noise3d.hpp"
+#include "erosion.hpp"
+#include "cube_sphere.hpp"
+#include "parallel.hpp"
+#include "biome.hpp"
+#include "terrain_shading.hpp"
+#include "image_export.hpp"
+#include "horizon.hpp"
+#include "drainage.hpp"
+#include "regeneration.hpp"
+#include "scene_frame.hpp"
+
+
+struct BenchmarkSettings
+{
+    std::vector<int> resolutions{ 256, 512, 2048 };
+    std::vector<int> thread_counts;
+    int repetitions = 3;
+    std::string filter;
+    std::string output_path;
+    std::string baseline_path;
+    double regression_threshold = 0.10;
+};
+
+struct BenchmarkResult
+{
+    std::string name;
+    std::string kernel;
+    int resolution;
+    int threads;
+    double seconds;
+    double items_per_second;
+    double speedup;
+};
+
+
+//////////////////////////////
+// HELPERS
+//////////////////////////////
+static std::vector<int> ParseIntList(const std::string& text)
+{
+    std::vector<int> values;
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ','))
+        if (!item.empty())
+            values.push_back(std::atoi(item.c_str()));
+    return values;
+}
+
+static std::vector<int> DefaultThreadCounts()
+{
+    int max_threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    std::vector<int> counts;
+    for (int count = 1; count < max_threads; count *= 2)
+        counts.push_back(count);
+    counts.push_back(max_threads);
+    return counts;
+}
+
+static std::vector<glm::vec3> SpherePoints(int n_points)
+{
+    // Fibonacci sphere, deterministic so runs are comparable
+    std::vector<glm::vec3> points(n_points);
+    float golden_angle = glm::pi<float>() * (3.0f - glm::sqrt(5.0f));
+    for (int k = 0; k < n_points; ++k)
+    {
+        float y = 1.0f - 2.0f * (k + 0.5f) / n_points;
+        float r = glm::sqrt(1.0f - y * y);
+        float phi = golden_angle * k;
+        points[k] = glm::vec3(r * glm::cos(phi), y, r * glm::sin(phi));
+    }
+    return points;
+}
+
+// Setup runs untimed before every repetition, for kernels that consume their input
+template<typename Setup, typename Function>
+static double MedianSeconds(int repetitions, const Setup& setup, const Function& function)
+{
+    std::vector<double> samples;
+    for (int k = 0; k < std::max(1, repetitions); ++k)
+    {
+        setup();
+        auto start = std::chrono::steady_clock::now();
+        function();
+        auto stop = std::chrono::steady_clock::now();
+        samples.push_back(std::chrono::duration<double>(stop - start).count());
+    }
+    std::sort(samples.begin(), samples.end());
+    return samples[samples.size() / 2];
+}
+
+template<typename Function>
+static double MedianSeconds(int repetitions, const Function& function)
+{
+    return MedianSeconds(repetitions, []() {}, function);
+}
+
+// Glob match where * is any run of characters and ? any one character
+static bool MatchesPattern(const std::string& text, const std::string& pattern)
+{
+    size_t t = 0;
+    size_t p = 0;
+    size_t star = std::string::npos;
+    size_t star_text = 0;
+    while (t < text.size())
+    {
+        if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == text[t]))
+        {
+            ++t;
+            ++p;
+        }
+        else if (p < pattern.size() && pattern[p] == '*')
+        {
+            star = p++;
+            star_text = t;
+        }
+        else if (star != std::string::npos)
+        {
+            p = star + 1;
+            t = ++star_text;
+        }
+        else
+            return false;
+    }
+    while (p < pattern.size() && pattern[p] == '*')
+        ++p;
+    return p == pattern.size();
+}
+
+static volatile float benchmark_sink = 0.0f;
+
+// Climate inputs of GenerateBiomes at sphere points, computed once so only the classification is timed
+static void FixedClimate(int n_points, std::vector<float>& temperature, std::vector<float>& rainfall)
+{
+    auto points = SpherePoints(n_points);
+    temperature.resize(n_points);
+    rainfall.resize(n_points);
+    for (int k = 0; k < n_points; ++k)
+    {
+        const auto& point = points[k];
+        float cos_sq = point.y * point.y;
+        float sin_sq = 1.0f - cos_sq;
+        float t = sin_sq + 0.1f * SmoothNoise(5.0f * point + glm::vec3(0.0013f, 15.0029f, 0.0047f));
+        float r = 4.0f * sin_sq * cos_sq + 0.4f * SmoothNoise(3.0f * point + glm::vec3(0.0013f, 15.0029f, 0.0047f));
+        temperature[k] = glm::clamp(t, 0.0f, 1.0f);
+        rainfall[k] = glm::clamp(r, 0.0f, 1.0f);
+    }
+}
+
+// The hard-coded rainfall band chain the lookup table replaced, kept as the reference
+static glm::vec4 ClassifyBiomeBranches(float temperature, float rainfall)
+{
+    float tundra = glm::clamp(0.5f - (temperature - 0.3f) / 0.1f, 0.0f, 1.0f);
+    float shrub = (1.0f - tundra);
+    float grass = (1.0f - tundra);
+    float forest = (1.0f - tundra);
+    if (rainfall < 0.1f)
+    {
+        grass = 0.0f;
+        forest = 0.0f;
+    }
+    else if (rainfall < 0.3f)
+    {
+        float blend = 0.5f - (rainfall - 0.2f) / (2.0f * 0.1f);
+        shrub *= blend;
+        grass *= (1.0f - blend);
+        forest = 0.0f;
+    }
+    else if (rainfall < 0.5f)
+    {
+        shrub = 0.0f;
+        forest = 0.0f;
+    }
+    else if (rainfall < 0.7f)
+    {
+        float blend = 0.5f - (rainfall - 0.6f) / (2.0f * 0.1f);
+        shrub = 0.0f;
+        grass *= blend;
+        forest *= (1.0f - blend);
+    }
+    else
+    {
+        shrub = 0.0f;
+        grass = 0.0f;
+    }
+    return glm::vec4(tundra, shrub, grass, forest);
+}
+
+
+struct NoiseSpectrum
+{
+    double standard_deviation = 0.0;
+    double high_band_fraction = 0.0;
+    double anisotropy = 0.0;
+};
+
+/*
+Spectral check of a noise basis.
+The power spectrum of a line of samples gives the fraction of variance above
+one cycle per lattice unit, which shows up as grain or aliasing in octaves.
+Anisotropy is the ratio of derivative variance along the x axis to that along
+the cube diagonal, 1 for an isotropic basis.
+*/
+template<typename Basis>
+static NoiseSpectrum MeasureNoiseSpectrum()
+{
+    const int n_samples = 4096;
+    const float spacing = 1.0f / 8.0f;
+    glm::vec3 origin(17.3f, -4.1f, 9.7f);
+    glm::vec3 direction = glm::normalize(glm::vec3(0.31f, 0.87f, 0.38f));
+
+    std::vector<double> samples(n_samples);
+    double mean = 0.0;
+    for (int k = 0; k < n_samples; ++k)
+    {
+        samples[k] = Basis::Evaluate(origin + (k * spacing) * direction, 1);
+        mean += samples[k];
+    }
+    mean /= n_samples;
+
+    NoiseSpectrum spectrum;
+    double total_power = 0.0;
+    double high_power = 0.0;
+    for (int f = 1; f < n_samples / 2; ++f)
+    {
+        double re = 0.0;
+        double im = 0.0;
+        for (int k = 0; k < n_samples; ++k)
+        {
+            double angle = glm::two_pi<double>() * f * k / n_samples;
+            re += (samples[k] - mean) * std::cos(angle);
+            im -= (samples[k] - mean) * std::sin(angle);
+        }
+        double power = re * re + im * im;
+        total_power += power;
+        if (f / (n_samples * spacing) > 1.0)
+            high_power += power;
+    }
+    for (double sample : samples)
+        spectrum.standard_deviation += (sample - mean) * (sample - mean);
+    spectrum.standard_deviation = std::sqrt(spectrum.standard_deviation / n_samples);
+    spectrum.high_band_fraction = total_power > 0.0 ? high_power / total_power : 0.0;
+
+    const float step = 1e-3f;
+    glm::vec3 axis(1.0f, 0.0f, 0.0f);
+    glm::vec3 diagonal = glm::normalize(glm::vec3(1.0f));
+    double axis_variance = 0.0;
+    double diagonal_variance = 0.0;
+    for (int k = 0; k < n_samples; ++k)
+    {
+        glm::vec3 point = origin + (k * 0.37f) * direction;
+        float value = Basis::Evaluate(point, 1);
+        double axis_slope = (Basis::Evaluate(point + step * axis, 1) - value) / step;
+        double diagonal_slope = (Basis::Evaluate(point + step * diagonal, 1) - value) / step;
+        axis_variance += axis_slope * axis_slope;
+        diagonal_variance += diagonal_slope * diagonal_slope;
+    }
+    spectrum.anisotropy = diagonal_variance > 0.0 ? axis_variance / diagonal_variance : 0.0;
+    return spectrum;
+}
+
+
+//////////////////////////////
+// BENCHMARK RUNNER
+//////////////////////////////
+class BenchmarkRunner
+{
+    BenchmarkSettings m_settings;
+    std::vector<BenchmarkResult> m_results;
+
+public:
+    BenchmarkRunner(const BenchmarkSettings& settings) :
+        m_settings(settings)
+    {
+    }
+
+    const std::vector<BenchmarkResult>& GetResults() const { return m_results; }
+
+    bool IsEnabled(const std::string& kernel) const
+    {
+        return m_settings.filter.empty() || MatchesPattern(kernel, m_settings.filter);
+    }
+
+    void Record(
+        const std::string& kernel,
+        int resolution,
+        int threads,
+        double seconds,
+        double items)
+    {
+        BenchmarkResult result;
+        result.name = kernel + "/" + std::to_string(resolution) + "/threads:" + std::to_string(threads);
+        result.kernel = kernel;
+        result.resolution = resolution;
+        result.threads = threads;
+        result.seconds = seconds;
+        result.items_per_second = items / seconds;
+        result.speedup = 1.0;
+        for (const auto& other : m_results)
+            if (other.kernel == kernel && other.resolution == resolution && other.threads == 1)
+                result.speedup = other.seconds / seconds;
+        m_results.push_back(result);
+
+        std::printf(
+            "%-48s %12.3f ms %14.4g items/s %6.2fx\n",
+            result.name.c_str(),
+            1000.0 * result.seconds,
+            result.items_per_second,
+            result.speedup);
+        std::fflush(stdout);
+    }
+
+    // Per point noise cost, single threaded
+    void RunNoiseBenchmarks()
+    {
+        int n_points = 1 << 18;
+        auto points = SpherePoints(n_points);
+
+        if (IsEnabled("FractalNoise"))
+        {
+            auto seconds = MedianSeconds(m_settings.repetitions, [&]() {
+                float sum = 0.0f;
+                for (const auto& point : points)
+                    sum += FractalNoise(point, 4.0f, 4, 0.7f, 2.0f);
+                benchmark_sink = sum;
+            });
+            Record("FractalNoise", 0, 1, seconds, n_points);
+        }
+        if (IsEnabled("FractalRidgeNoise"))
+        {
+            auto seconds = MedianSeconds(m_settings.repetitions, [&]() {
+                float sum = 0.0f;
+                for (const auto& point : points)
+                    sum += FractalRidgeNoise(point, 2.0f, 4, 0.5f, 2.0f);
+                benchmark_sink = sum;
+            });
+            Record("FractalRidgeNoise", 0, 1, seconds, n_points);
+        }
+        if (IsEnabled("FractalRidgeNoiseGradient"))
+        {
+            auto seconds = MedianSeconds(m_settings.repetitions, [&]() {
+                float sum = 0.0f;
+                for (const auto& point : points)
+                    sum += FractalRidgeNoiseGradient(point, 2.0f, 4, 0.5f, 2.0f).gradient.x;
+                benchmark_sink = sum;
+            });
+            Record("FractalRidgeNoiseGradient", 0, 1, seconds, n_points);
+        }
+
+        RunNoiseBasisBenchmark<SimplexBasis>("Simplex", points);
+        RunNoiseBasisBenchmark<GradientBasis>("Gradient", points);
+        RunNoiseBasisBenchmark<ValueBasis>("Value", points);
+        RunNoiseBasisBenchmark<OpenSimplex2Basis>("OpenSimplex2", points);
+    }
+
+    // Eight octave ridge noise per basis, plus its spectral check
+    template<typename Basis>
+    void RunNoiseBasisBenchmark(const std::string& name, const std::vector<glm::vec3>& points)
+    {
+        std::string kernel = "NoiseBasis" + name;
+        if (!IsEnabled(kernel))
+            return;
+
+        auto seconds = MedianSeconds(m_settings.repetitions, [&]() {
+            float sum = 0.0f;
+            for (const auto& point : points)
+                sum += FractalRidgeNoise<Basis>(point, 2.0f, 8, 0.5f, 2.0f, 7);
+            benchmark_sink = sum;
+        });
+        Record(kernel, 0, 1, seconds, double(points.size()) * 8);
+
+        // Cost against glm::simplex over the same points, when it ran
+        double simplex_seconds = 0.0;
+        for (const auto& result : m_results)
+            if (result.kernel == "NoiseBasisSimplex")
+                simplex_seconds = result.seconds;
+
+        auto spectrum = MeasureNoiseSpectrum<Basis>();
+        std::printf(
+            "%-48s std %.3f  above 1/unit %.4f  anisotropy %.3f",
+            "",
+            spectrum.standard_deviation,
+            spectrum.high_band_fraction,
+            spectrum.anisotropy);
+        if (simplex_seconds > 0.0)
+            std::printf("  cost %.2fx simplex", seconds / simplex_seconds);
+        std::printf("\n");
+    }
+
+    // Splat weights from fixed climate inputs, the lookup table against the branch chain
+    void RunBiomeBenchmarks()
+    {
+        BiomeLookupTable biome_table(DefaultBiomeDefinitions());
+        for (int resolution : m_settings.resolutions)
+        {
+            int n_texels = 6 * resolution * resolution;
+            std::vector<float> temperature;
+            std::vector<float> rainfall;
+            if (IsEnabled("BiomeClassifyLookup") || IsEnabled("BiomeClassifyBranches"))
+                FixedClimate(n_texels, temperature, rainfall);
+            std::vector<glm::vec4> splat(n_texels);
+
+            if (IsEnabled("BiomeClassifyLookup"))
+            {
+                auto seconds = MedianSeconds(m_settings.repetitions, [&]() {
+                    for (int k = 0; k < n_texels; ++k)
+                        splat[k] = biome_table.Sample(temperature[k], rainfall[k]);
+                    benchmark_sink = splat[n_texels / 2].x;
+                });
+                Record("BiomeClassifyLookup", resolution, 1, seconds, n_texels);
+            }
+            if (IsEnabled("BiomeClassifyBranches"))
+            {
+                auto seconds = MedianSeconds(m_settings.repetitions, [&]() {
+                    for (int k = 0; k < n_texels; ++k)
+                        splat[k] = ClassifyBiomeBranches(temperature[k], rainfall[k]);
+                    benchmark_sink = splat[n_texels / 2].x;
+                });
+                Record("BiomeClassifyBranches", resolution, 1, seconds, n_texels);
+            }
+        }
+    }
+
+    // Whole cubemap passes at every resolution and thread count
+    void RunCubemapBenchmarks()
+    {
+        BiomeLookupTable biome_table(DefaultBiomeDefinitions());
+
+        for (int resolution : m_settings.resolutions)
+        {
+            double n_texels = 6.0 * resolution * resolution;
+            auto height_data = std::make_shared<CubemapData>(resolution, 1);
+            GenerateNoiseHeightmap(height_data);
+
+            for (int threads : m_settings.thread_counts)
+            {
+                SetWorkerThreadCount(threads);
+
+                if (IsEnabled("GenerateNoiseHeightmap"))
+                {
+                    auto seconds = MedianSeconds(m_settings.repetitions, [&]() {
+                        GenerateNoiseHeightmap(height_data);
+                    });
+                    Record("GenerateNoiseHeightmap", resolution, threads, seconds, n_texels);
+                }
+                if (IsEnabled("GenerateNoiseHeightmapWithNormals"))
+                {
+                    auto normal_data = std::make_shared<CubemapData>(resolution, 3);
+                    auto seconds = MedianSeconds(m_settings.repetitions, [&]() {
+                        GenerateNoiseHeightmap(height_data, normal_data);
+                    });
+                    Record("GenerateNoiseHeightmapWithNormals", resolution, threads, seconds, n_texels);
+                }
+                if (IsEnabled("CalculateNormalMap"))
+                {
+                    auto normal_data = std::make_shared<CubemapData>(resolution, 3);
+                    auto seconds = MedianSeconds(m_settings.repetitions, [&]() {
+                        CalculateNormalMap(height_data, normal_data);
+                    });
+                    Record("CalculateNormalMap", resolution, threads, seconds, n_texels);
+                }
+                if (IsEnabled("GenerateBiomes"))
+                {
+                    auto splat_data = std::make_shared<CubemapData>(resolution, 4);
+                    auto seconds = MedianSeconds(m_settings.repetitions, [&]() {
+                        GenerateBiomes(splat_data, biome_table);
+                    });
+                    Record("GenerateBiomes", resolution, threads, seconds, n_texels);
+                }
+                if (IsEnabled("GenerateMaterialIndexMap"))
+                {
+                    auto splat_data = std::make_shared<CubemapData>(resolution, 4);
+                    auto material_data = std::make_shared<CubemapData>(resolution, 3);
+                    GenerateBiomes(splat_data, biome_table);
+                    MaterialCoverageReport coverage;
+                    auto seconds = MedianSeconds(m_settings.repetitions, [&]() {
+                        coverage = GenerateMaterialIndexMap(splat_data, material_data);
+                    });
+                    Record("GenerateMaterialIndexMap", resolution, threads, seconds, n_texels);
+                    std::printf(
+                        "%-48s over two %.4f  differing %.4f  dropped max %.4f mean %.6f\n",
+                        "",
+                        double(coverage.texels_over_two) / coverage.texels,
+                        coverage.DifferingFraction(),
+                        coverage.max_dropped_weight,
+                        coverage.mean_dropped_weight);
+                }
+                if (IsEnabled("SmoothMap"))
+                {
+                    auto seconds = MedianSeconds(m_settings.repetitions, [&]() {
+                        SmoothMap(height_data, 1);
+                    });
+                    Record("SmoothMap", resolution, threads, seconds, n_texels);
+                }
+                if (IsEnabled("BakeHorizonMap"))
+                {
+                    auto horizon_data = std::make_shared<CubemapData>(resolution, 4);
+                    auto seconds = MedianSeconds(m_settings.repetitions, [&]() {
+                        BakeHorizonMap(height_data, horizon_data);
+                    });
+                    Record("BakeHorizonMap", resolution, threads, seconds, n_texels);
+                }
+                if (IsEnabled("ComputeDrainage"))
+                {
+                    auto flow_data = std::make_shared<CubemapData>(resolution, 3);
+                    auto lake_data = std::make_shared<CubemapData>(resolution, 1);
+                    auto seconds = MedianSeconds(m_settings.repetitions, [&]() {
+                        ComputeDrainage(height_data, flow_data, lake_data);
+                    });
+                    Record("ComputeDrainage", resolution, threads, seconds, n_texels);
+                }
+                if (IsEnabled("ExportCubemapFaces"))
+                {
+                    auto prefix = (std::filesystem::temp_directory_path() / "terrain_benchmark").string();
+                    auto seconds = MedianSeconds(m_settings.repetitions, [&]() {
+                        ExportCubemapFaces(*height_data, 1, prefix, ImageFormat::Png16);
+                    });
+                    Record("ExportCubemapFaces", resolution, threads, seconds, n_texels);
+                }
+                if (IsEnabled("ExportEquirectangular"))
+                {
+                    // Panorama with about as many texels as the cubemap
+                    auto path = (std::filesystem::temp_directory_path() / "terrain_benchmark.exr").string();
+                    int width = 2 * resolution;
+                    auto seconds = MedianSeconds(m_settings.repetitions, [&]() {
+                        ExportEquirectangular(*height_data, 1, path, ImageFormat::Exr, width);
+                    });
+                    Record("ExportEquirectangular", resolution, threads, seconds, 0.5 * width * width);
+                }
+                if (IsEnabled("TerrainStageGraph"))
+                {
+                    // Editor pipeline from an empty cache, biomes overlap the height stages
+                    PlanetConfig config;
+                    config.resolution = resolution;
+                    config.smooth_iterations = 1;
+                    StageGraphReport report;
+                    auto seconds = MedianSeconds(m_settings.repetitions, [&]() {
+                        StageGraph graph(resolution);
+                        AddTerrainStages(graph, config, biome_table);
+                        std::string error;
+                        graph.Run(report, error);
+                    });
+                    Record("TerrainStageGraph", resolution, threads, seconds, n_texels);
+
+                    // Wall time can not drop below the critical path, however many threads run
+                    std::printf(
+                        "%-48s stage sum %.2f ms  critical path %.2f ms  wall %.2fx critical path\n",
+                        "",
+                        1000.0 * report.stage_seconds,
+                        1000.0 * report.critical_path_seconds,
+                        seconds / report.critical_path_seconds);
+                }
+                if (IsEnabled("TerrainStageGraphNoiseEdit"))
+                {
+                    // A seed change reruns the height stages, biomes and materials are reused
+                    PlanetConfig config;
+                    config.resolution = resolution;
+                    config.smooth_iterations = 1;
+                    StageCache cache;
+                    StageGraphReport report;
+                    auto run = [&]() {
+                        config.noise.seed++;
+                        StageGraph graph(resolution);
+                        AddTerrainStages(graph, config, biome_table);
+                        std::string error;
+                        graph.Run(report, error, &cache);
+                    };
+                    run();
+                    auto seconds = MedianSeconds(m_settings.repetitions, run);
+                    Record("TerrainStageGraphNoiseEdit", resolution, threads, seconds, n_texels);
+                    std::printf(
+                        "%-48s %d of %zu stages reused\n",
+                        "",
+                        report.stages_reused,
+                        report.stages.size());
+                }
+            }
+        }
+        SetWorkerThreadCount(0);
+    }
+
+    // Erosion particle throughput, the update loop is serial
+    void RunErosionBenchmarks()
+    {
+        if (!IsEnabled("UpdateParticle"))
+            return;
+
+        for (int resolution : m_settings.resolutions)
+        {
+            float grid_spacing = 1.0f / resolution;
+            ErosionParameters erosion_params;
+            erosion_params.concentration_factor = 3.0f;
+            erosion_params.erosion_time = 0.5f;
+            erosion_params.evaporation_time = 1.0f;
+            erosion_params.friction_time = 0.5;
+            erosion_params.particle_start_volume = 0.8f * grid_spacing * grid_spacing;
+
+            int n_particles = 1000;
+            int n_steps = 100;
+            std::vector<ErosionParticle> initial_particles(n_particles);
+            for (auto& p : initial_particles) { InitializeParticle(p, erosion_params); }
+
+            // Every repetition erodes the same fresh heightmap with the same particles
+            auto height_data = std::make_shared<CubemapData>(resolution, 1);
+            std::vector<ErosionParticle> particles;
+            auto setup = [&]() {
+                GenerateNoiseHeightmap(height_data);
+                particles = initial_particles;
+            };
+            auto seconds = MedianSeconds(m_settings.repetitions, setup, [&]() {
+                for (int i = 0; i < n_steps; ++i)
+                    for (auto& p : particles)
+                        UpdateParticle(p, *height_data, erosion_params);
+            });
+            Record("UpdateParticle", resolution, 1, seconds, double(n_particles) * n_steps);
+        }
+    }
+
+    // Full resolution erosion against the coarse to fine schedule for the same coarse step count
+    void RunErosionScheduleBenchmarks()
+    {
+        int n_steps = 2000;
+        for (int resolution : m_settings.resolutions)
+        {
+            if (IsEnabled("ErodeHeightmap"))
+            {
+                ErosionRunSettings run_settings;
+                run_settings.max_steps = n_steps;
+                run_settings.convergence_tolerance = 0.0f;
+
+                auto height_data = std::make_shared<CubemapData>(resolution, 1);
+                auto seconds = MedianSeconds(1, [&]() {
+                    GenerateNoiseHeightmap(height_data);
+                    ErodeHeightmap(height_data, run_settings);
+                });
+                Record("ErodeHeightmap", resolution, 1, seconds, n_steps);
+            }
+            if (IsEnabled("ErodeHeightmapMultigrid"))
+            {
+                MultigridErosionSettings multigrid_settings;
+                multigrid_settings.coarse_steps = n_steps;
+                multigrid_settings.refinement_steps = n_steps / 10;
+                multigrid_settings.level_settings.convergence_tolerance = 0.0f;
+
+                auto height_data = std::make_shared<CubemapData>(resolution, 1);
+                auto seconds = MedianSeconds(1, [&]() {
+                    GenerateNoiseHeightmap(height_data);
+                    ErodeHeightmapMultigrid(height_data, multigrid_settings);
+                });
+                Record("ErodeHeightmapMultigrid", resolution, 1, seconds, n_steps);
+            }
+        }
+    }
+
+    void RunMeshBenchmarks()
+    {
+        if (!IsEnabled("BuildSphereMesh"))
+            return;
+
+        for (int n_divisions : { 20, 128, 512 })
+        {
+            auto seconds = MedianSeconds(m_settings.repetitions, [&]() {
+                auto mesh = BuildSphereMesh(n_divisions);
+                benchmark_sink = mesh->GetVertex(0).position.x;
+            });
+            Record("BuildSphereMesh", n_divisions, 1, seconds, 6.0 * n_divisions * n_divisions);
+        }
+    }
+
+    /*
+    Per frame CPU cost of SceneLayer::OnUpdate against the null render backend.
+    Batched runs SceneFrame::Update, the scene layer's own frame step, and then
+    the editor's per frame SetSettings; drawing the scene and ImGui need a GPU
+    and are left out. PerName is the path before batching, where every uniform
+    was looked up by name and uploaded each frame.
+    */
+    void RunFrameBenchmarks()
+    {
+        const int n_frames = 100000;
+        const float time_step = 1.0f / 60.0f;
+
+        if (IsEnabled("FrameUniformsPerName"))
+        {
+            auto seconds = MedianSeconds(m_settings.repetitions, [&]() {
+                RecordingUniformTarget target;
+                TerrainShadingSettings settings;
+                auto set_float = [&target](const std::string& name, float value) {
+                    target.SetUniformFloat(target.GetUniformLocation(name), value);
+                };
+                auto set_float3 = [&target](const std::string& name, const glm::vec3& value) {
+                    target.SetUniformFloat3(target.GetUniformLocation(name), value);
+                };
+                for (int frame = 0; frame < n_frames; ++frame)
+                {
+                    set_float("time", frame * time_step);
+                    set_float3("u_water_shallow_color", settings.water_shallow_color);
+                    set_float3("u_water_deep_color", settings.water_deep_color);
+                    set_float("u_water_level", settings.water_level);
+                    set_float("u_water_depth_scale", settings.water_depth_scale);
+                    set_float("u_water_speed", settings.water_speed);
+                    set_float("u_water_scale", settings.water_scale);
+                    set_float("u_terrain_texture_scales[0]", settings.texture_scales[0]);
+                    set_float("u_terrain_texture_scales[1]", settings.texture_scales[1]);
+                    set_float("u_terrain_texture_scales[2]", settings.texture_scales[2]);
+                    set_float("u_terrain_texture_scales[3]", settings.texture_scales[3]);
+                }
+                benchmark_sink = static_cast<float>(target.GetUploadCount());
+            });
+            Record("FrameUniformsPerName", 0, 1, seconds, n_frames);
+        }
+
+        // Idle editor, only time changes; Editing drags the water level slider every frame
+        for (bool editing : { false, true })
+        {
+            std::string kernel = editing ? "FrameUniformsBatchedEditing" : "FrameUniformsBatched";
+            if (!IsEnabled(kernel))
+                continue;
+
+            auto seconds = MedianSeconds(m_settings.repetitions, [&]() {
+                RecordingUniformTarget target;
+                TerrainShadingSettings settings;
+                auto uniforms = std::make_shared<TerrainShadingUniforms>(settings);
+                auto regenerator = std::make_shared<TerrainRegenerator>();
+                SceneFrame scene_frame(uniforms, regenerator);
+                for (int frame = 0; frame < n_frames; ++frame)
+                {
+                    if (auto maps = scene_frame.Update(time_step, target))
+                        benchmark_sink = static_cast<float>(maps->generation);
+                    if (editing)
+                        settings.water_level = 0.3f + 0.5f * (frame % 100) / 100.0f;
+                    uniforms->SetSettings(settings);
+                }
+                benchmark_sink = static_cast<float>(target.GetUploadCount());
+            });
+            Record(kernel, 0, 1, seconds, n_frames);
+        }
+    }
+};
+
+
+//////////////////////////////
+// REPORTING
+//////////////////////////////
+static void WriteJson(const std::string& path, const std::vector<BenchmarkResult>& results)
+{
+    std::ofstream file(path);
+    file << "{\n";
+    file << "  \"hardware_concurrency\": " << std::thread::hardware_concurrency() << ",\n";
+    file << "  \"benchmarks\": [\n";
+    for (size_t k = 0; k < results.size(); ++k)
+    {
+        const auto& result = results[k];
+        file << "    { "
+            << "\"name\": \"" << result.name << "\", "
+            << "\"kernel\": \"" << result.kernel << "\", "
+            << "\"resolution\": " << result.resolution << ", "
+            << "\"threads\": " << result.threads << ", "
+            << "\"seconds\": " << result.seconds << ", "
+            << "\"items_per_second\": " << result.items_per_second << ", "
+            << "\"speedup\": " << result.speedup
+            << " }" << (k + 1 < results.size() ? "," : "") << "\n";
+    }
+    file << "  ]\n";
+    file << "}\n";
+}
+
+// Reads back the name/seconds pairs written by WriteJson
+static std::vector<std::pair<std::string, double>> ReadBaseline(const std::string& path)
+{
+    std::ifstream file(path);
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    std::string text = buffer.str();
+
+    std::vector<std::pair<std::string, double>> entries;
+    const std::string name_key = "\"name\": \"";
+    const std::string seconds_key = "\"seconds\": ";
+    size_t position = text.find(name_key);
+    while (position != std::string::npos)
+    {
+        size_t name_begin = position + name_key.size();
+        size_t name_end = text.find('"', name_begin);
+        size_t seconds_begin = text.find(seconds_key, name_end);
+        if (name_end == std::string::npos || seconds_begin == std::string::npos)
+            break;
+        seconds_begin += seconds_key.size();
+
+        entries.emplace_back(
+            text.substr(name_begin, name_end - name_begin),
+            std::atof(text.c_str() + seconds_begin));
+        position = text.find(name_key, seconds_begin);
+    }
+    return entries;
+}
+
+static int CompareToBaseline(
+    const std::vector<BenchmarkResult>& results,
+    const std::string& baseline_path,
+    double threshold)
+{
+    auto baseline = ReadBaseline(baseline_path);
+    if (baseline.empty())
+    {
+        std::printf("Could not read baseline %s\n", baseline_path.c_str());
+        return 1;
+    }
+
+    int n_regressions = 0;
+    std::printf("\nComparison against %s (threshold %.1f%%)\n", baseline_path.c_str(), 100.0 * threshold);
+    for (const auto& result : results)
+    {
+        for (const auto& entry : baseline)
+        {
+            if (entry.first != result.name || entry.second <= 0.0)
+                continue;
+
+            double ratio = result.seconds / entry.second;
+            bool regressed = ratio > 1.0 + threshold;
+            n_regressions += regressed ? 1 : 0;
+            std::printf(
+                "%-48s %12.3f ms -> %12.3f ms %+7.1f%% %s\n",
+                result.name.c_str(),
+                1000.0 * entry.second,
+                1000.0 * result.seconds,
+                100.0 * (ratio - 1.0),
+                regressed ? "REGRESSION" : "");
+        }
+    }
+    std::printf("%d regression(s)\n", n_regressions);
+    return n_regressions > 0 ? 1 : 0;
+}
+
+
+//////////////////////////////
+// MAIN
+//////////////////////////////
+static void PrintUsage()
+{
+    std::printf(
+        "Usage: ProceduralTerrainBenchmark [options]\n"
+        "  --resolutions=256,512,2048  Cubemap face resolutions\n"
+        "  --threads=1,2,4             Worker thread counts for scaling runs\n"
+        "  --repetitions=3             Timed runs per benchmark, median is reported\n"
+        "  --filter=Name               Only run kernels matching Name, * and ? are wildcards\n"
+        "  --output=results.json       Write machine readable results\n"
+        "  --baseline=baseline.json    Compare to saved results, fail on regressions\n"
+        "  --threshold=0.10            Allowed slowdown fraction before failing\n");
+}
+
+int main(int argc, char** argv)
+{
+    BenchmarkSettings settings;
+    settings.thread_counts = DefaultThreadCounts();
+
+    for (int k = 1; k < argc; ++k)
+    {
+        std::string argument = argv[k];
+        auto value_of = [&argument](const std::string& key) {
+            return argument.substr(key.size());
+        };
+
+        if (argument.rfind("--resolutions=", 0) == 0)
+            settings.resolutions = ParseIntList(value_of("--resolutions="));
+        else if (argument.rfind("--threads=", 0) == 0)
+            settings.thread_counts = ParseIntList(value_of("--threads="));
+        else if (argument.rfind("--repetitions=", 0) == 0)
+            settings.repetitions = std::atoi(value_of("--repetitions=").c_str());
+        else if (argument.rfind("--filter=", 0) == 0)
+            settings.filter = value_of("--filter=");
+        else if (argument.rfind("--output=", 0) == 0)
+            settings.output_path = value_of("--output=");
+        else if (argument.rfind("--baseline=", 0) == 0)
+            settings.baseline_path = value_of("--baseline=");
+        else if (argument.rfind("--threshold=", 0) == 0)
+            settings.regression_threshold = std::atof(value_of("--threshold=").c_str());
+        else
+        {
+            PrintUsage();
+            return argument == "--help" ? 0 : 1;
+        }
+    }
+
+    BenchmarkRunner runner(settings);
+    runner.RunNoiseBenchmarks();
+    runner.RunBiomeBenchmarks();
+    runner.RunCubemapBenchmarks();
+    runner.RunErosionBenchmarks();
+    runner.RunErosionScheduleBenchmarks();
+    runner.RunMeshBenchmarks();
+    runner.RunFrameBenchmarks();
+
+    if (!settings.output_path.empty())
+        WriteJson(settings.output_path, runner.GetResults());
+
+    if (!settings.baseline_path.empty())
+        return CompareToBaseline(
+            runner.GetResults(),
+            settings.baseline_path,
+            settings.regression_threshold);
+
+    return 0;
+}
@@ -0,0 +1,411 @@
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include "batch.hpp"
+#include "cubemap_geometry.hpp"
+#include "distributed.hpp"
+#include "memory_arena.hpp"
+#include "parallel.hpp"
+#include "profiler.hpp"
+
+
+//////////////////////////////
+// MANIFEST
+//////////////////////////////
+static bool ApplyPlanetSetting(
+    PlanetConfig& config,
+    const std::string& key,
+    const std::string& value)
+{
+    if (key == "name")
+        config.name = value;
+    else if (key == "resolution")
+        config.resolution = std::stoi(value);
+    else if (key == "seed")
+        config.noise.seed = static_cast<uint32_t>(std::stoul(value));
+    else if (key == "frequency")
+        config.noise.base_frequency = std::stof(value);
+    else if (key == "octaves")
+        config.noise.octaves = std::stoi(value);
+    else if (key == "persistence")
+        config.noise.persistence = std::stof(value);
+    else if (key == "lacunarity")
+        config.noise.frequency_multiplier = std::stof(value);
+    else if (key == "height_scale")
+        config.noise.height_scale = std::stof(value);
+    else if (key == "erosion_steps")
+        config.erosion_steps = std::stoi(value);
+    else if (key == "multigrid")
+        config.multigrid_erosion = std::stoi(value) != 0;
+    else if (key == "smooth")
+        config.smooth_iterations = std::stoi(value);
+    else if (key == "drainage")
+        config.drainage = std::stoi(value) != 0;
+    else
+        return false;
+    return true;
+}
+
+bool ReadPlanetManifest(
+    const std::string& path,
+    std::vector<PlanetConfig>& planets,
+    std::string& error)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        error = "Could not open manifest " + path;
+        return false;
+    }
+
+    std::string line;
+    int line_number = 0;
+    while (std::getline(file, line))
+    {
+        line_number++;
+        std::stringstream stream(line);
+        std::string token;
+        if (!(stream >> token) || token[0] == '#')
+            continue;
+
+        PlanetConfig config;
+        config.name = "planet_" + std::to_string(planets.size());
+        do
+        {
+            auto separator = token.find('=');
+            bool applied = false;
+            if (separator != std::string::npos)
+            {
+                try
+                {
+                    applied = ApplyPlanetSetting(
+                        config,
+                        token.substr(0, separator),
+                        token.substr(separator + 1));
+                }
+                catch (const std::exception&)
+                {
+                    applied = false;
+                }
+            }
+            if (!applied)
+            {
+                error = path + ":" + std::to_string(line_number) + ": invalid setting '" + token + "'";
+                return false;
+            }
+        } while (stream >> token);
+
+        if (config.resolution < 2)
+        {
+            error = path + ":" + std::to_string(line_number) + ": resolution must be at least 2";
+            return false;
+        }
+        planets.push_back(config);
+    }
+    return true;
+}
+
+uint64_t PlanetMemoryCost(const PlanetConfig& config)
+{
+    // Height, normal and splat maps, plus the erosion snapshot and pyramid,
+    // the drainage maps and the flood's working arrays
+    uint64_t face_texels = uint64_t(config.resolution) * config.resolution;
+    uint64_t floats_per_texel = 1 + 3 + 4;
+    if (config.erosion_steps > 0)
+        floats_per_texel += 2;
+    if (config.drainage)
+        floats_per_texel += 3 + 1;
+    uint64_t bytes = 6 * face_texels * floats_per_texel * sizeof(float);
+    if (config.drainage)
+        bytes += DrainageScratchBytes(config.resolution);
+    return bytes;
+}
+
+const char* PlanetStageName(PlanetStage stage)
+{
+    switch (stage)
+    {
+    case PlanetStage::Heightmap: return "Heightmap";
+    case PlanetStage::Erosion: return "Erosion";
+    case PlanetStage::Smoothing: return "Smoothing";
+    case PlanetStage::Normals: return "Normals";
+    case PlanetStage::Biomes: return "Biomes";
+    case PlanetStage::Drainage: return "Drainage";
+    case PlanetStage::Output: return "Output";
+    default: return "Unknown";
+    }
+}
+
+
+//////////////////////////////
+// SCHEDULER
+//////////////////////////////
+static void WriteCubemapRaw(const std::string& path, CubemapData& data, int channels)
+{
+    std::ofstream file(path, std::ios::binary);
+    size_t face_size = size_t(data.GetResolution()) * data.GetResolution() * channels * sizeof(float);
+    for (int face_id = CubeFace::Begin; face_id < CubeFace::End; ++face_id)
+    {
+        auto face = static_cast<CubeFace>(face_id);
+        file.write(reinterpret_cast<const char*>(data.GetFaceDataPointer(face)), face_size);
+    }
+}
+
+struct PlanetJob
+{
+    const PlanetConfig* config = nullptr;
+    uint64_t memory_cost = 0;
+    PlanetStage stage = PlanetStage::Heightmap;
+    std::shared_ptr<CubemapData> height_data = nullptr;
+    std::shared_ptr<CubemapData> normal_data = nullptr;
+    std::shared_ptr<CubemapData> splat_data = nullptr;
+    std::shared_ptr<CubemapData> flow_data = nullptr;
+    std::shared_ptr<CubemapData> lake_data = nullptr;
+};
+
+class BatchScheduler
+{
+    const std::vector<PlanetConfig>& m_planets;
+    const BatchSettings& m_settings;
+    BiomeLookupTable m_biome_table;
+    int m_max_in_flight;
+
+    std::mutex m_mutex;
+    std::condition_variable m_finished;
+    size_t m_next_planet = 0;
+    int m_in_flight = 0;
+    uint64_t m_memory_in_use = 0;
+    // Planets in flight per resolution, each resolution's geometry is counted once
+    std::map<int, int> m_resolution_planets;
+    BatchReport m_report;
+
+public:
+    BatchScheduler(
+        const std::vector<PlanetConfig>& planets,
+        const BatchSettings& settings) :
+        m_planets(planets),
+        m_settings(settings),
+        m_biome_table(DefaultBiomeDefinitions()),
+        m_max_in_flight(
+            settings.max_planets_in_flight > 0 ?
+            settings.max_planets_in_flight :
+            SharedThreadPool().GetThreadCount())
+    {
+    }
+
+    BatchReport Run()
+    {
+        auto start = std::chrono::steady_clock::now();
+        double pool_busy_start = SharedThreadPool().GetBusySeconds();
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        AdmitLocked();
+        m_finished.wait(lock, [this]() {
+            return m_report.planets_completed == static_cast<int>(m_planets.size());
+        });
+
+        auto stop = std::chrono::steady_clock::now();
+        m_report.wall_seconds = std::chrono::duration<double>(stop - start).count();
+        m_report.pool_busy_seconds = SharedThreadPool().GetBusySeconds() - pool_busy_start;
+        m_report.pool_threads = SharedThreadPool().GetThreadCount();
+        m_report.arena_high_water_bytes = SharedTerrainArena().GetStatistics().high_water_bytes;
+
+        // Every planet has dropped its maps, nothing else will reuse the pool
+        SharedTerrainArena().Trim();
+        return m_report;
+    }
+
+private:
+    // Starts queued planets while they fit in the memory budget, caller holds the lock
+    void AdmitLocked()
+    {
+        while (m_next_planet < m_planets.size() && m_in_flight < m_max_in_flight)
+        {
+            auto job = std::make_shared<PlanetJob>();
+            job->config = &m_planets[m_next_planet];
+            job->memory_cost = PlanetMemoryCost(*job->config);
+            int resolution = job->config->resolution;
+            uint64_t geometry_cost = m_resolution_planets.count(resolution) ? 0 : CubemapGeometryBytes(resolution);
+            if (m_in_flight > 0 && m_memory_in_use + job->memory_cost + geometry_cost > m_settings.memory_budget_bytes)
+                break;
+
+            m_next_planet++;
+            m_in_flight++;
+            m_resolution_planets[resolution]++;
+            m_memory_in_use += job->memory_cost + geometry_cost;
+            m_report.peak_memory_bytes = std::max(m_report.peak_memory_bytes, m_memory_in_use);
+            SharedThreadPool().Submit([this, job]() { RunStage(job); });
+        }
+    }
+
+    bool IsStageEnabled(const PlanetJob& job, PlanetStage stage) const
+    {
+        switch (stage)
+        {
+        case PlanetStage::Erosion: return job.config->erosion_steps > 0;
+        case PlanetStage::Smoothing: return job.config->smooth_iterations > 0;
+        case PlanetStage::Normals:
+            // Un-eroded heightmaps get exact normals from the heightmap pass
+            return job.config->erosion_steps > 0 || job.config->smooth_iterations > 0;
+        case PlanetStage::Biomes:
+            // Worker tiles already carry the splat weights
+            return m_settings.coordinator == nullptr;
+        case PlanetStage::Drainage: return job.config->drainage;
+        case PlanetStage::Output: return !m_settings.output_directory.empty();
+        default: return true;
+        }
+    }
+
+    void ExecuteStage(PlanetJob& job)
+    {
+        const auto& config = *job.config;
+        switch (job.stage)
+        {
+        case PlanetStage::Heightmap:
+            job.height_data = SharedTerrainArena().AcquireCubemap(config.resolution, 1);
+            job.normal_data = SharedTerrainArena().AcquireCubemap(config.resolution, 3);
+            job.splat_data = SharedTerrainArena().AcquireCubemap(config.resolution, 4);
+            if (m_settings.coordinator != nullptr)
+            {
+                // Blocks this pool thread until the workers have sent every tile
+                std::shared_ptr<CubemapData> analytic_normals = nullptr;
+                if (!IsStageEnabled(job, PlanetStage::Normals))
+                    analytic_normals = job.normal_data;
+                m_settings.coordinator->GenerateBaseMaps(
+                    config.noise, job.height_data, analytic_normals, job.splat_data);
+            }
+            else if (IsStageEnabled(job, PlanetStage::Normals))
+                GenerateNoiseHeightmap(job.height_data, config.noise);
+            else
+                GenerateNoiseHeightmap(job.height_data, job.normal_data, config.noise);
+            break;
+        case PlanetStage::Erosion:
+            if (config.multigrid_erosion)
+            {
+                MultigridErosionSettings erosion_settings;
+                erosion_settings.coarse_steps = config.erosion_steps;
+                erosion_settings.refinement_steps = config.erosion_steps / 10;
+                ErodeHeightmapMultigrid(job.height_data, erosion_settings);
+            }
+            else
+            {
+                ErosionRunSettings erosion_settings;
+                erosion_settings.max_steps = config.erosion_steps;
+                ErodeHeightmap(job.height_data, erosion_settings);
+            }
+            break;
+        case PlanetStage::Smoothing:
+            SmoothMap(job.height_data, config.smooth_iterations);
+            break;
+        case PlanetStage::Normals:
+            CalculateNormalMap(job.height_data, job.normal_data);
+            break;
+        case PlanetStage::Biomes:
+            GenerateBiomes(job.splat_data, m_biome_table);
+            break;
+        case PlanetStage::Drainage:
+            job.flow_data = SharedTerrainArena().AcquireCubemap(config.resolution, 3);
+            job.lake_data = SharedTerrainArena().AcquireCubemap(config.resolution, 1);
+            ComputeDrainage(job.height_data, job.flow_data, job.lake_data);
+            break;
+        case PlanetStage::Output:
+        {
+            std::string prefix = m_settings.output_directory + "/" + config.name;
+            WriteOutput(prefix + "_height", *job.height_data, 1);
+            WriteOutput(prefix + "_normal", *job.normal_data, 3);
+            WriteOutput(prefix + "_splat", *job.splat_data, 4);
+            if (job.flow_data != nullptr)
+            {
+                WriteOutput(prefix + "_flow", *job.flow_data, 3);
+                WriteOutput(prefix + "_lake", *job.lake_data, 1);
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    void WriteOutput(const std::string& prefix, CubemapData& data, int channels)
+    {
+        if (!m_settings.export_images)
+        {
+            WriteCubemapRaw(prefix + ".raw", data, channels);
+            return;
+        }
+
+        ExportCubemapFaces(data, channels, prefix, m_settings.image_format);
+        if (m_settings.equirectangular_width > 0)
+        {
+            ExportEquirectangular(
+                data,
+                channels,
+                prefix + "_equirect." + ImageFormatExtension(m_settings.image_format),
+                m_settings.image_format,
+                m_settings.equirectangular_width);
+        }
+    }
+
+    void RunStage(std::shared_ptr<PlanetJob> job)
+    {
+        TERRAIN_PROFILE_SCOPE(PlanetStageName(job->stage));
+        auto start = std::chrono::steady_clock::now();
+        ExecuteStage(*job);
+        auto stop = std::chrono::steady_clock::now();
+
+        auto stage_index = static_cast<size_t>(job->stage);
+        do
+        {
+            job->stage = static_cast<PlanetStage>(static_cast<int>(job->stage) + 1);
+        } while (job->stage != PlanetStage::Count && !IsStageEnabled(*job, job->stage));
+
+        bool planet_done = job->stage == PlanetStage::Count;
+        if (planet_done)
+        {
+            job->height_data = nullptr;
+            job->normal_data = nullptr;
+            job->splat_data = nullptr;
+            job->flow_data = nullptr;
+            job->lake_data = nullptr;
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_report.stages[stage_index].runs++;
+        m_report.stages[stage_index].busy_seconds += std::chrono::duration<double>(stop - start).count();
+
+        if (!planet_done)
+        {
+            // Requeue behind other planets' stages so work interleaves
+            SharedThreadPool().Submit([this, job]() { RunStage(job); });
+            return;
+        }
+
+        m_in_flight--;
+        m_memory_in_use -= job->memory_cost;
+        int resolution = job->config->resolution;
+        if (--m_resolution_planets[resolution] == 0)
+        {
+            m_resolution_planets.erase(resolution);
+            m_memory_in_use -= CubemapGeometryBytes(resolution);
+        }
+        m_report.planets_completed++;
+        AdmitLocked();
+        if (m_report.planets_completed == static_cast<int>(m_planets.size()))
+            m_finished.notify_all();
+    }
+};
+
+
+BatchReport RunPlanetBatch(
+    const std::vector<PlanetConfig>& planets,
+    const BatchSettings& settings)
+{
+    if (planets.empty())
+        return BatchReport();
+
+    BatchScheduler scheduler(planets, settings);
+    return scheduler.Run();
+}
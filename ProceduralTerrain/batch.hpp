@@ -0,0 +1,104 @@
+#ifndef BATCH_HPP
+#define BATCH_HPP
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "terrain.hpp"
+#include "image_export.hpp"
+#include "drainage.hpp"
+
+class TileCoordinator;
+
+struct PlanetConfig
+{
+    std::string name;
+    int resolution = 512;
+    TerrainNoiseParameters noise;
+    int erosion_steps = 0;
+    bool multigrid_erosion = true;
+    int smooth_iterations = 0;
+    bool drainage = false;
+};
+
+/*
+Reads one planet per line as whitespace separated key=value pairs, e.g.
+    name=alpha resolution=512 seed=7 octaves=5 erosion_steps=2000 smooth=1 drainage=1
+Blank lines and lines starting with '#' are skipped.
+Returns false and fills error on malformed input.
+*/
+bool ReadPlanetManifest(
+    const std::string& path,
+    std::vector<PlanetConfig>& planets,
+    std::string& error);
+
+// Bytes of cubemap data held while a planet is in flight
+uint64_t PlanetMemoryCost(const PlanetConfig& config);
+
+
+enum class PlanetStage
+{
+    Heightmap,
+    Erosion,
+    Smoothing,
+    Normals,
+    Biomes,
+    Drainage,
+    Output,
+    Count
+};
+
+const char* PlanetStageName(PlanetStage stage);
+
+
+struct BatchSettings
+{
+    uint64_t memory_budget_bytes = uint64_t(4) << 30;
+    int max_planets_in_flight = 0;
+    std::string output_directory;
+
+    // Raw float faces unless export_images is set; a non-zero width adds panoramas
+    bool export_images = false;
+    ImageFormat image_format = ImageFormat::Png16;
+    int equirectangular_width = 0;
+
+    // Heights, analytic normals and biomes come from the coordinator's workers when set
+    TileCoordinator* coordinator = nullptr;
+};
+
+struct BatchStageReport
+{
+    int runs = 0;
+    double busy_seconds = 0.0;
+};
+
+struct BatchReport
+{
+    int planets_completed = 0;
+    double wall_seconds = 0.0;
+    double pool_busy_seconds = 0.0;
+    int pool_threads = 0;
+    uint64_t peak_memory_bytes = 0;
+    uint64_t arena_high_water_bytes = 0;
+    std::array<BatchStageReport, static_cast<size_t>(PlanetStage::Count)> stages{};
+
+    inline double PlanetsPerHour() const
+    {
+        return wall_seconds > 0.0 ? 3600.0 * planets_completed / wall_seconds : 0.0;
+    }
+};
+
+
+/*
+Generates many planets on the shared thread pool.
+Each planet advances one stage per pool task, so stages of different
+planets interleave. New planets are only admitted while their cubemap
+memory, plus the cubemap geometry of each resolution in flight, fits in
+the budget; one planet is always admitted so an oversized config still
+runs.
+*/
+BatchReport RunPlanetBatch(
+    const std::vector<PlanetConfig>& planets,
+    const BatchSettings& settings);
+
+#endif
@@ -0,0 +1,78 @@
+#include <stdexcept>
+#include <string>
+#include "biome.hpp"
+#include "stage_graph.hpp"
+
+
+static float BandWeight(float x, float min_x, float max_x, float blend)
+{
+    float rise = glm::clamp((x - min_x) / blend + 0.5f, 0.0f, 1.0f);
+    float fall = glm::clamp((max_x - x) / blend + 0.5f, 0.0f, 1.0f);
+    return glm::min(rise, fall);
+}
+
+std::vector<BiomeDefinition> DefaultBiomeDefinitions()
+{
+    // Band edges sit in the middle of their blend regions
+    return std::vector<BiomeDefinition>{
+        // channel, temperature range, blend, rainfall range, blend
+        BiomeDefinition{ 0, -1.0f, 0.3f, 0.1f, -1.0f, 2.0f, 0.2f }, // Tundra
+        BiomeDefinition{ 1, 0.3f, 2.0f, 0.1f, -1.0f, 0.2f, 0.2f },  // Shrub
+        BiomeDefinition{ 2, 0.3f, 2.0f, 0.1f, 0.2f, 0.6f, 0.2f },   // Grass
+        BiomeDefinition{ 3, 0.3f, 2.0f, 0.1f, 0.6f, 2.0f, 0.2f },   // Forest
+    };
+}
+
+BiomeLookupTable::BiomeLookupTable(
+    const std::vector<BiomeDefinition>& biomes,
+    int resolution) :
+    m_resolution(glm::max(resolution, 2)),
+    m_weights(m_resolution * m_resolution, glm::vec4(0.0f)),
+    m_hash(HashValue(m_resolution))
+{
+    for (const auto& biome : biomes)
+    {
+        if (biome.material_channel < 0 || biome.material_channel > 3)
+            throw std::invalid_argument(
+                "Biome material channel " + std::to_string(biome.material_channel) + " is outside 0-3");
+        m_hash = HashValue(biome.material_channel, m_hash);
+        m_hash = HashValue(biome.min_temperature, m_hash);
+        m_hash = HashValue(biome.max_temperature, m_hash);
+        m_hash = HashValue(biome.temperature_blend, m_hash);
+        m_hash = HashValue(biome.min_rainfall, m_hash);
+        m_hash = HashValue(biome.max_rainfall, m_hash);
+        m_hash = HashValue(biome.rainfall_blend, m_hash);
+    }
+
+    for (int j = 0; j < m_resolution; ++j)
+    {
+        float rainfall = j / (m_resolution - 1.0f);
+        for (int i = 0; i < m_resolution; ++i)
+        {
+            float temperature = i / (m_resolution - 1.0f);
+
+            glm::vec4 weights(0.0f);
+            for (const auto& biome : biomes)
+            {
+                float weight = (
+                    BandWeight(
+                        temperature,
+                        biome.min_temperature,
+                        biome.max_temperature,
+                        biome.temperature_blend) *
+                    BandWeight(
+                        rainfall,
+                        biome.min_rainfall,
+                        biome.max_rainfall,
+                        biome.rainfall_blend));
+                weights[biome.material_channel] += weight;
+            }
+
+            float total = weights.x + weights.y + weights.z + weights.w;
+            if (total > 0.0f)
+                weights /= total;
+
+            m_weights[j * m_resolution + i] = weights;
+        }
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef BIOME_HPP
+#define BIOME_HPP
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+
+struct BiomeDefinition
+{
+    int material_channel;
+    float min_temperature;
+    float max_temperature;
+    float temperature_blend;
+    float min_rainfall;
+    float max_rainfall;
+    float rainfall_blend;
+};
+
+std::vector<BiomeDefinition> DefaultBiomeDefinitions();
+
+
+/*
+Precomputed temperature x rainfall -> splat weight table.
+All biome definitions are baked in on construction so the per texel
+cost is one bilinear fetch regardless of how many biomes exist.
+Temperature and rainfall are expected to be clamped to [0, 1].
+Throws std::invalid_argument for a material channel outside 0-3.
+*/
+class BiomeLookupTable
+{
+    int m_resolution;
+    std::vector<glm::vec4> m_weights;
+    uint64_t m_hash;
+
+public:
+    BiomeLookupTable(
+        const std::vector<BiomeDefinition>& biomes,
+        int resolution = 201);
+
+    inline int GetResolution() const { return m_resolution; }
+
+    // Equal for tables baked from the same definitions
+    inline uint64_t GetHash() const { return m_hash; }
+
+    inline glm::vec4 Sample(float temperature, float rainfall) const
+    {
+        float scale = m_resolution - 1.0f;
+        float x = temperature * scale;
+        float y = rainfall * scale;
+
+        int i0 = glm::min(static_cast<int>(x), m_resolution - 2);
+        int j0 = glm::min(static_cast<int>(y), m_resolution - 2);
+        float fx = x - i0;
+        float fy = y - j0;
+
+        const glm::vec4* row0 = &m_weights[j0 * m_resolution + i0];
+        const glm::vec4* row1 = row0 + m_resolution;
+
+        glm::vec4 w0 = row0[0] + fx * (row0[1] - row0[0]);
+        glm::vec4 w1 = row1[0] + fx * (row1[1] - row1[0]);
+        return w0 + fy * (w1 - w0);
+    }
+};
+
+#endif
@@ -77,6 +77,25 @@ glm::vec3 SphereHeightmapVTangent(
     return tangent;
 }
 
+void SphereHeightmapTangents(
+    CubemapCoordinates coordinates,
+    float height,
+    CubemapData& heightmap,
+    glm::vec3& u_tangent,
+    glm::vec3& v_tangent)
+{
+    float step = 1.0f / heightmap.GetResolution();
+    auto p0 = CubeToSphere(CubemapData::CubePoint(coordinates)) * (0.5f + height);
+
+    auto u_coordinates = coordinates;
+    u_coordinates.u += step;
+    u_tangent = (SphereHeightmapPoint(u_coordinates, heightmap) - p0) / step;
+
+    auto v_coordinates = coordinates;
+    v_coordinates.v += step;
+    v_tangent = (SphereHeightmapPoint(v_coordinates, heightmap) - p0) / step;
+}
+
 std::shared_ptr<Mesh<Vertex_XNTBUV>> BuildSphereMesh(int n_face_divisions)
 {
     // Initialize mesh storage
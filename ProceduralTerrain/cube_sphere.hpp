@@ -29,6 +29,18 @@ glm::vec3 SphereHeightmapVTangent(
     glm::vec3 direction,
     CubemapData& heightmap);
 
+/*
+Both tangents at once for a point whose coordinates and interpolated
+height are already known, sharing the base point between them.
+Matches SphereHeightmapUTangent and SphereHeightmapVTangent exactly.
+*/
+void SphereHeightmapTangents(
+    CubemapCoordinates coordinates,
+    float height,
+    CubemapData& heightmap,
+    glm::vec3& u_tangent,
+    glm::vec3& v_tangent);
+
 std::shared_ptr<Mesh<Vertex_XNTBUV>> BuildSphereMesh(int n_face_divisions);
 
 #endif
\ No newline at end of file
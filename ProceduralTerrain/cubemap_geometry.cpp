@@ -0,0 +1,179 @@
+#include <cmath>
+#include <glm/gtc/constants.hpp>
+#include "cubemap_geometry.hpp"
+#include "parallel.hpp"
+#include "profiler.hpp"
+
+
+// A cached resolution holds CubemapGeometryBytes, about 37 bytes per texel
+// or 0.9 GB at 2048, for as long as it stays among the most recent ones
+static const size_t cached_resolution_count = 4;
+
+// Solid angle of the face plane rectangle [0, x] x [0, y] at unit distance
+static double FaceCornerSolidAngle(double x, double y)
+{
+    return std::atan2(x * y, std::sqrt(x * x + y * y + 1.0));
+}
+
+static void ResizePlanes(CubemapFacePlanes& planes, size_t texel_count)
+{
+    planes.x.resize(texel_count);
+    planes.y.resize(texel_count);
+    planes.z.resize(texel_count);
+}
+
+
+CubemapGeometry::CubemapGeometry(int resolution) :
+    m_resolution(resolution)
+{
+    TERRAIN_PROFILE_SCOPE("CubemapGeometry/Directions");
+    size_t face_texels = size_t(resolution) * resolution;
+    for (auto& planes : m_directions)
+        ResizePlanes(planes, face_texels);
+
+    ParallelFor(6 * resolution, [this, resolution](int row) {
+        auto face = static_cast<CubeFace>(row / resolution);
+        int j = row % resolution;
+        auto& planes = m_directions[face];
+        for (int i = 0; i < resolution; ++i)
+        {
+            auto direction = TexelDirection(face, i, j, resolution);
+            size_t texel = size_t(j) * resolution + i;
+            planes.x[texel] = direction.x;
+            planes.y[texel] = direction.y;
+            planes.z[texel] = direction.z;
+        }
+    });
+}
+
+const CubemapFacePlanes& CubemapGeometry::UTangents(CubeFace face)
+{
+    std::call_once(m_tangents_built, [this]() { BuildTangents(); });
+    return m_u_tangents[face];
+}
+
+const CubemapFacePlanes& CubemapGeometry::VTangents(CubeFace face)
+{
+    std::call_once(m_tangents_built, [this]() { BuildTangents(); });
+    return m_v_tangents[face];
+}
+
+const std::vector<float>& CubemapGeometry::SolidAngles(CubeFace)
+{
+    std::call_once(m_solid_angles_built, [this]() { BuildSolidAngles(); });
+    return m_solid_angles;
+}
+
+float CubemapGeometry::MeanSolidAngle() const
+{
+    return 4.0f * glm::pi<float>() / (6.0f * m_resolution * m_resolution);
+}
+
+/*
+A face point p(u, v) is affine in u and v and d = p / |p|, so
+dd/du = (dp/du - d (d . dp/du)) / |p|, and 1 / |p| is the direction's
+largest absolute component since p lies on the unit cube.
+*/
+void CubemapGeometry::BuildTangents()
+{
+    TERRAIN_PROFILE_SCOPE("CubemapGeometry/Tangents");
+    int resolution = m_resolution;
+    size_t face_texels = size_t(resolution) * resolution;
+    for (int face_id = CubeFace::Begin; face_id < CubeFace::End; ++face_id)
+    {
+        ResizePlanes(m_u_tangents[face_id], face_texels);
+        ResizePlanes(m_v_tangents[face_id], face_texels);
+    }
+
+    ParallelFor(6 * resolution, [this, resolution](int row) {
+        auto face = static_cast<CubeFace>(row / resolution);
+        int j = row % resolution;
+        auto origin = CubemapData::CubePoint(CubemapCoordinates{ face, 0.0f, 0.0f });
+        auto du = CubemapData::CubePoint(CubemapCoordinates{ face, 1.0f, 0.0f }) - origin;
+        auto dv = CubemapData::CubePoint(CubemapCoordinates{ face, 0.0f, 1.0f }) - origin;
+
+        const auto& directions = m_directions[face];
+        auto& u_tangents = m_u_tangents[face];
+        auto& v_tangents = m_v_tangents[face];
+        for (int i = 0; i < resolution; ++i)
+        {
+            size_t texel = size_t(j) * resolution + i;
+            auto direction = directions.Get(texel);
+            auto magnitude = glm::abs(direction);
+            float inverse_length = glm::max(magnitude.x, glm::max(magnitude.y, magnitude.z));
+
+            auto u_tangent = inverse_length * (du - glm::dot(direction, du) * direction);
+            auto v_tangent = inverse_length * (dv - glm::dot(direction, dv) * direction);
+            u_tangents.x[texel] = u_tangent.x;
+            u_tangents.y[texel] = u_tangent.y;
+            u_tangents.z[texel] = u_tangent.z;
+            v_tangents.x[texel] = v_tangent.x;
+            v_tangents.y[texel] = v_tangent.y;
+            v_tangents.z[texel] = v_tangent.z;
+        }
+    });
+}
+
+// Every face covers the same [-1, 1]^2 plane rectangle
+void CubemapGeometry::BuildSolidAngles()
+{
+    TERRAIN_PROFILE_SCOPE("CubemapGeometry/SolidAngles");
+    int resolution = m_resolution;
+    auto& solid_angles = m_solid_angles;
+    solid_angles.resize(size_t(resolution) * resolution);
+
+    ParallelFor(resolution, [&solid_angles, resolution](int j) {
+        double y0 = 2.0 * j / resolution - 1.0;
+        double y1 = 2.0 * (j + 1) / resolution - 1.0;
+        for (int i = 0; i < resolution; ++i)
+        {
+            double x0 = 2.0 * i / resolution - 1.0;
+            double x1 = 2.0 * (i + 1) / resolution - 1.0;
+            solid_angles[size_t(j) * resolution + i] = static_cast<float>(
+                FaceCornerSolidAngle(x1, y1) -
+                FaceCornerSolidAngle(x0, y1) -
+                FaceCornerSolidAngle(x1, y0) +
+                FaceCornerSolidAngle(x0, y0));
+        }
+    });
+}
+
+
+std::shared_ptr<CubemapGeometry> SharedCubemapGeometry(int resolution)
+{
+    // Most recently used first
+    static std::mutex mutex;
+    static std::vector<std::shared_ptr<CubemapGeometry>> cache;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    for (size_t k = 0; k < cache.size(); ++k)
+    {
+        if (cache[k]->GetResolution() != resolution)
+            continue;
+        auto geometry = cache[k];
+        cache.erase(cache.begin() + k);
+        cache.insert(cache.begin(), geometry);
+        return geometry;
+    }
+
+    // Built without the lock; if a concurrent request got there first its copy wins
+    lock.unlock();
+    auto geometry = std::make_shared<CubemapGeometry>(resolution);
+    lock.lock();
+    for (const auto& cached : cache)
+    {
+        if (cached->GetResolution() == resolution)
+            return cached;
+    }
+    cache.insert(cache.begin(), geometry);
+    if (cache.size() > cached_resolution_count)
+        cache.pop_back();
+    return geometry;
+}
+
+uint64_t CubemapGeometryBytes(int resolution)
+{
+    // Directions and both tangents are three planes per face, solid angles one face
+    uint64_t face_texels = uint64_t(resolution) * resolution;
+    return (6 * 9 + 1) * face_texels * sizeof(float);
+}
@@ -0,0 +1,100 @@
+#ifndef CUBEMAP_GEOMETRY_HPP
+#define CUBEMAP_GEOMETRY_HPP
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <Merlin/Render/cubemap_data.hpp>
+#include <glm/glm.hpp>
+
+using namespace Merlin;
+
+
+// One vector per texel as separate x, y and z planes, rows back to back like CubemapData faces
+struct CubemapFacePlanes
+{
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+
+    inline glm::vec3 Get(size_t texel) const
+    {
+        return glm::vec3(x[texel], y[texel], z[texel]);
+    }
+};
+
+
+// Unit vector through a texel center, what CubemapGeometry stores for it
+inline glm::vec3 TexelDirection(CubeFace face, int i, int j, int resolution)
+{
+    return glm::normalize(CubemapData::CubePoint(CubemapCoordinates{
+        face,
+        (i + 0.5f) / resolution,
+        (j + 0.5f) / resolution }));
+}
+
+
+/*
+Per texel geometry shared by every pass working at one cubemap resolution.
+Directions are the unit vectors through the texel centers and are built
+up front. Tangents are the derivatives of the direction with respect to
+the face u and v coordinates, which are tangent to the sphere and span the
+texel's tangent frame. Solid angles are exact per texel and sum to 4 pi;
+every face has the same ones, so they are stored once for all faces.
+Tangents and solid angles are only built on first use. Everything is built
+on the shared thread pool and read only afterwards.
+*/
+class CubemapGeometry
+{
+    int m_resolution;
+    std::array<CubemapFacePlanes, 6> m_directions;
+    std::array<CubemapFacePlanes, 6> m_u_tangents;
+    std::array<CubemapFacePlanes, 6> m_v_tangents;
+    std::vector<float> m_solid_angles;
+    std::once_flag m_tangents_built;
+    std::once_flag m_solid_angles_built;
+
+public:
+    explicit CubemapGeometry(int resolution);
+
+    CubemapGeometry(const CubemapGeometry&) = delete;
+    CubemapGeometry& operator=(const CubemapGeometry&) = delete;
+
+    inline int GetResolution() const { return m_resolution; }
+
+    inline const CubemapFacePlanes& Directions(CubeFace face) const { return m_directions[face]; }
+
+    inline glm::vec3 Direction(CubeFace face, int i, int j) const
+    {
+        return m_directions[face].Get(size_t(j) * m_resolution + i);
+    }
+
+    const CubemapFacePlanes& UTangents(CubeFace face);
+
+    const CubemapFacePlanes& VTangents(CubeFace face);
+
+    // The same array for every face
+    const std::vector<float>& SolidAngles(CubeFace face);
+
+    // Solid angle of the average texel, 4 pi / (6 resolution^2)
+    float MeanSolidAngle() const;
+
+private:
+    void BuildTangents();
+
+    void BuildSolidAngles();
+};
+
+
+/*
+Geometry for the given resolution, built on the first request.
+The most recently used resolutions stay cached; passes hold on to the
+returned pointer while they run, so eviction never frees geometry in use.
+*/
+std::shared_ptr<CubemapGeometry> SharedCubemapGeometry(int resolution);
+
+// Bytes held by the geometry of one resolution once tangents and solid angles are built
+uint64_t CubemapGeometryBytes(int resolution);
+
+#endif
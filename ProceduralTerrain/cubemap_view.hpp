@@ -0,0 +1,89 @@
+#ifndef CUBEMAP_VIEW_HPP
+#define CUBEMAP_VIEW_HPP
+#include <array>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <Merlin/Render/cubemap_data.hpp>
+#include <glm/glm.hpp>
+
+using namespace Merlin;
+
+
+// Texel type for a channel count, single channel maps are plain floats
+template<int Channels>
+struct CubemapPixel;
+
+template<>
+struct CubemapPixel<1> { using Type = float; };
+
+template<>
+struct CubemapPixel<2> { using Type = glm::vec2; };
+
+template<>
+struct CubemapPixel<3> { using Type = glm::vec3; };
+
+template<>
+struct CubemapPixel<4> { using Type = glm::vec4; };
+
+
+/*
+Typed access to the faces of a CubemapData with Channels floats per texel.
+Face pointers are looked up once and the texel stride is a compile time
+constant, so rows can be walked as arrays of Pixel and a whole texel is
+read or written with one glm vector access. The data must outlive the
+view. Throws std::invalid_argument unless the data has exactly Channels
+channels. A view of const float is read only.
+*/
+template<typename T, int Channels>
+class CubemapView
+{
+    static_assert(std::is_same<typename std::remove_const<T>::type, float>::value, "cubemap data is float");
+
+public:
+    // Const for read only views
+    using Pixel = typename std::conditional<
+        std::is_const<T>::value,
+        const typename CubemapPixel<Channels>::Type,
+        typename CubemapPixel<Channels>::Type>::type;
+    static_assert(
+        sizeof(Pixel) == Channels * sizeof(float) && alignof(Pixel) == alignof(float),
+        "texels must be packed floats, aligned glm types do not fit");
+
+private:
+    std::array<T*, 6> m_faces;
+    int m_resolution;
+
+public:
+    explicit CubemapView(CubemapData& data) :
+        m_resolution(data.GetResolution())
+    {
+        if (data.GetChannelCount() != Channels)
+            throw std::invalid_argument(
+                "Cubemap has " + std::to_string(data.GetChannelCount()) +
+                " channels, the view expects " + std::to_string(Channels));
+        for (int face_id = CubeFace::Begin; face_id < CubeFace::End; ++face_id)
+            m_faces[face_id] = data.GetFaceDataPointer(static_cast<CubeFace>(face_id));
+    }
+
+    inline int GetResolution() const { return m_resolution; }
+
+    // Channels floats per texel, rows back to back
+    inline T* Face(CubeFace face) const { return m_faces[face]; }
+
+    inline Pixel* Row(CubeFace face, int j) const
+    {
+        return reinterpret_cast<Pixel*>(m_faces[face]) + size_t(j) * m_resolution;
+    }
+
+    inline Pixel& operator()(CubeFace face, int i, int j) const
+    {
+        return Row(face, j)[i];
+    }
+};
+
+template<int Channels>
+using ConstCubemapView = CubemapView<const float, Channels>;
+
+#endif
@@ -0,0 +1,729 @@
+#include <algorithm>
+#include <cstring>
+#include "distributed.hpp"
+#include "parallel.hpp"
+#include "profiler.hpp"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+
+//////////////////////////////
+// SOCKETS
+//////////////////////////////
+#ifdef _WIN32
+using SocketHandle = SOCKET;
+static const SocketHandle invalid_socket = INVALID_SOCKET;
+
+static void CloseSocket(SocketHandle handle) { closesocket(handle); }
+#else
+using SocketHandle = int;
+static const SocketHandle invalid_socket = -1;
+
+static void CloseSocket(SocketHandle handle) { close(handle); }
+#endif
+
+#ifdef MSG_NOSIGNAL
+static const int send_flags = MSG_NOSIGNAL;
+#else
+static const int send_flags = 0;
+#endif
+
+static bool InitializeSockets()
+{
+#ifdef _WIN32
+    static const bool initialized = []() {
+        WSADATA data;
+        return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+    }();
+    return initialized;
+#else
+    return true;
+#endif
+}
+
+// Tiles are small and latency bound, and a dead peer must not raise SIGPIPE
+static void ConfigureSocket(SocketHandle handle)
+{
+    int enable = 1;
+    setsockopt(handle, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&enable), sizeof(enable));
+#ifdef SO_NOSIGPIPE
+    setsockopt(handle, SOL_SOCKET, SO_NOSIGPIPE, &enable, sizeof(enable));
+#endif
+}
+
+// Zero waits forever, a timed out receive fails like a closed connection
+static void SetReceiveTimeout(SocketHandle handle, double seconds)
+{
+#ifdef _WIN32
+    DWORD milliseconds = static_cast<DWORD>(seconds * 1000.0);
+    setsockopt(handle, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&milliseconds), sizeof(milliseconds));
+#else
+    timeval timeout;
+    timeout.tv_sec = static_cast<time_t>(seconds);
+    timeout.tv_usec = static_cast<suseconds_t>((seconds - timeout.tv_sec) * 1.0e6);
+    setsockopt(handle, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+#endif
+}
+
+static bool SendAll(SocketHandle handle, const void* data, size_t size)
+{
+    const char* bytes = static_cast<const char*>(data);
+    while (size > 0)
+    {
+        int sent = send(handle, bytes, static_cast<int>(std::min<size_t>(size, 1 << 20)), send_flags);
+        if (sent <= 0)
+            return false;
+        bytes += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+static bool ReceiveAll(SocketHandle handle, void* data, size_t size)
+{
+    char* bytes = static_cast<char*>(data);
+    while (size > 0)
+    {
+        int received = recv(handle, bytes, static_cast<int>(std::min<size_t>(size, 1 << 20)), 0);
+        if (received <= 0)
+            return false;
+        bytes += received;
+        size -= received;
+    }
+    return true;
+}
+
+
+//////////////////////////////
+// PROTOCOL
+//////////////////////////////
+/*
+Every message is a 12 byte header, magic, type and payload size, followed
+by the payload. Values are sent in host byte order, all supported hosts
+are little endian.
+
+Hello       worker -> coordinator  u32 version
+TileJob     coordinator -> worker  u64 job, i32 resolution, noise parameters,
+                                   i32 face, i0, j0, width, height, u32 normals
+TileResult  worker -> coordinator  u64 job, f32 seconds, u32 float count, floats
+Shutdown    coordinator -> worker  u32 version
+
+A hello with another version is answered with a shutdown before the
+coordinator closes the connection, so the worker can report both versions.
+*/
+static const uint32_t protocol_magic = 0x4E525450;
+static const uint32_t protocol_version = 1;
+static const uint32_t max_payload_bytes = 256u << 20;
+// Largest face resolution a tile job may name
+static const int32_t max_job_resolution = 1 << 16;
+
+enum class MessageType : uint32_t
+{
+    Hello = 1,
+    TileJob = 2,
+    TileResult = 3,
+    Shutdown = 4
+};
+
+class MessageWriter
+{
+    std::vector<char> m_bytes;
+
+public:
+    explicit MessageWriter(MessageType type)
+    {
+        Put(protocol_magic);
+        Put(static_cast<uint32_t>(type));
+        Put(uint32_t(0));
+    }
+
+    template<typename T>
+    void Put(const T& value)
+    {
+        PutBytes(&value, sizeof(T));
+    }
+
+    void PutBytes(const void* data, size_t size)
+    {
+        size_t offset = m_bytes.size();
+        m_bytes.resize(offset + size);
+        std::memcpy(m_bytes.data() + offset, data, size);
+    }
+
+    bool Send(SocketHandle handle)
+    {
+        uint32_t payload_size = static_cast<uint32_t>(m_bytes.size() - 12);
+        std::memcpy(m_bytes.data() + 8, &payload_size, sizeof(payload_size));
+        return SendAll(handle, m_bytes.data(), m_bytes.size());
+    }
+};
+
+// Reads past the end leave the reader failed instead of throwing
+class MessageReader
+{
+    std::vector<char> m_bytes;
+    size_t m_offset = 0;
+    bool m_ok = true;
+
+public:
+    MessageType type = MessageType::Hello;
+
+    bool Receive(SocketHandle handle)
+    {
+        uint32_t header[3];
+        if (!ReceiveAll(handle, header, sizeof(header)))
+            return false;
+        if (header[0] != protocol_magic || header[2] > max_payload_bytes)
+            return false;
+        type = static_cast<MessageType>(header[1]);
+        m_bytes.resize(header[2]);
+        m_offset = 0;
+        m_ok = true;
+        return ReceiveAll(handle, m_bytes.data(), m_bytes.size());
+    }
+
+    template<typename T>
+    T Get()
+    {
+        T value{};
+        GetBytes(&value, sizeof(T));
+        return value;
+    }
+
+    void GetBytes(void* data, size_t size)
+    {
+        if (!m_ok || m_offset + size > m_bytes.size())
+        {
+            m_ok = false;
+            return;
+        }
+        std::memcpy(data, m_bytes.data() + m_offset, size);
+        m_offset += size;
+    }
+
+    inline bool Ok() const { return m_ok && m_offset == m_bytes.size(); }
+};
+
+static void PutNoiseParameters(MessageWriter& writer, const TerrainNoiseParameters& parameters)
+{
+    writer.Put(parameters.seed);
+    writer.Put(parameters.base_frequency);
+    writer.Put(int32_t(parameters.octaves));
+    writer.Put(parameters.persistence);
+    writer.Put(parameters.frequency_multiplier);
+    writer.Put(parameters.height_scale);
+}
+
+static TerrainNoiseParameters GetNoiseParameters(MessageReader& reader)
+{
+    TerrainNoiseParameters parameters;
+    parameters.seed = reader.Get<uint32_t>();
+    parameters.base_frequency = reader.Get<float>();
+    parameters.octaves = reader.Get<int32_t>();
+    parameters.persistence = reader.Get<float>();
+    parameters.frequency_multiplier = reader.Get<float>();
+    parameters.height_scale = reader.Get<float>();
+    return parameters;
+}
+
+static size_t TileFloatCount(const CubemapTile& tile, bool normals)
+{
+    return size_t(tile.width) * tile.height * (normals ? 1 + 3 + 4 : 1 + 4);
+}
+
+
+//////////////////////////////
+// COORDINATOR
+//////////////////////////////
+struct TileCoordinator::MapRequest
+{
+    TerrainNoiseParameters parameters;
+    std::shared_ptr<CubemapData> height_data;
+    std::shared_ptr<CubemapData> normal_data;
+    std::shared_ptr<CubemapData> splat_data;
+    int remaining = 0;
+};
+
+TileCoordinator::TileCoordinator(const CoordinatorSettings& settings) :
+    m_state(std::make_shared<SharedState>()),
+    m_listen_socket(static_cast<uint64_t>(invalid_socket))
+{
+    m_state->settings = settings;
+    m_state->last_worker_seen = std::chrono::steady_clock::now();
+}
+
+TileCoordinator::~TileCoordinator()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_state->mutex);
+        m_state->stopping = true;
+    }
+    m_state->changed.notify_all();
+
+    if (m_accept_thread.joinable())
+        m_accept_thread.join();
+    if (static_cast<SocketHandle>(m_listen_socket) != invalid_socket)
+        CloseSocket(static_cast<SocketHandle>(m_listen_socket));
+
+    std::lock_guard<std::mutex> lock(m_threads_mutex);
+    for (auto& thread : m_threads)
+        thread.join();
+}
+
+bool TileCoordinator::Start(std::string& error)
+{
+    if (!InitializeSockets())
+    {
+        error = "Could not initialize sockets";
+        return false;
+    }
+
+    SocketHandle listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (listener == invalid_socket)
+    {
+        error = "Could not create the coordinator socket";
+        return false;
+    }
+    int enable = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&enable), sizeof(enable));
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(static_cast<uint16_t>(m_state->settings.port));
+    if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        listen(listener, 64) != 0)
+    {
+        CloseSocket(listener);
+        error = "Could not listen on port " + std::to_string(m_state->settings.port);
+        return false;
+    }
+
+    socklen_t address_size = sizeof(address);
+    getsockname(listener, reinterpret_cast<sockaddr*>(&address), &address_size);
+    m_port = ntohs(address.sin_port);
+    m_listen_socket = static_cast<uint64_t>(listener);
+    m_accept_thread = std::thread([this]() { AcceptLoop(); });
+    return true;
+}
+
+// Polls so the destructor can stop the loop without closing the socket under it
+void TileCoordinator::AcceptLoop()
+{
+    auto listener = static_cast<SocketHandle>(m_listen_socket);
+    while (true)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_state->mutex);
+            if (m_state->stopping)
+                return;
+        }
+
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(listener, &readable);
+        timeval timeout{ 0, 200000 };
+        if (select(static_cast<int>(listener) + 1, &readable, nullptr, nullptr, &timeout) <= 0)
+            continue;
+
+        SocketHandle connection = accept(listener, nullptr, nullptr);
+        if (connection == invalid_socket)
+            continue;
+        ConfigureSocket(connection);
+
+        auto state = m_state;
+        std::lock_guard<std::mutex> lock(m_threads_mutex);
+        m_threads.emplace_back([state, connection]() {
+            ServeWorker(state, static_cast<uint64_t>(connection));
+        });
+    }
+}
+
+bool TileCoordinator::WaitForWorkers(int count, double timeout_seconds)
+{
+    std::unique_lock<std::mutex> lock(m_state->mutex);
+    return m_state->changed.wait_for(
+        lock,
+        std::chrono::duration<double>(timeout_seconds),
+        [this, count]() { return m_state->live_workers >= count; });
+}
+
+void TileCoordinator::ServeWorker(std::shared_ptr<SharedState> state, uint64_t socket)
+{
+    auto connection = static_cast<SocketHandle>(socket);
+
+    // Connections that do not open with a hello are not workers
+    MessageReader hello;
+    SetReceiveTimeout(connection, state->settings.tile_timeout_seconds);
+    if (!hello.Receive(connection) || hello.type != MessageType::Hello)
+    {
+        CloseSocket(connection);
+        return;
+    }
+    uint32_t worker_version = hello.Get<uint32_t>();
+    if (!hello.Ok() || worker_version != protocol_version)
+    {
+        MessageWriter reject(MessageType::Shutdown);
+        reject.Put(protocol_version);
+        reject.Send(connection);
+        CloseSocket(connection);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->live_workers++;
+        state->report.workers_connected++;
+        state->report.peak_workers = std::max(state->report.peak_workers, state->live_workers);
+    }
+    state->changed.notify_all();
+
+    uint64_t job = 0;
+    std::vector<float> tile_data;
+    while (true)
+    {
+        TileTask task;
+        {
+            std::unique_lock<std::mutex> lock(state->mutex);
+            state->changed.wait(lock, [&state]() { return state->stopping || !state->queue.empty(); });
+            if (state->stopping)
+                break;
+            task = state->queue.front();
+            state->queue.pop_front();
+        }
+
+        const auto& tile = task.tile;
+        bool normals = task.request->normal_data != nullptr;
+        MessageWriter request(MessageType::TileJob);
+        request.Put(++job);
+        request.Put(int32_t(task.request->height_data->GetResolution()));
+        PutNoiseParameters(request, task.request->parameters);
+        request.Put(int32_t(tile.face));
+        request.Put(int32_t(tile.i0));
+        request.Put(int32_t(tile.j0));
+        request.Put(int32_t(tile.width));
+        request.Put(int32_t(tile.height));
+        request.Put(uint32_t(normals));
+
+        MessageReader reply;
+        bool delivered = request.Send(connection) && reply.Receive(connection);
+        if (delivered)
+        {
+            tile_data.resize(TileFloatCount(tile, normals));
+            uint64_t reply_job = reply.Get<uint64_t>();
+            float seconds = reply.Get<float>();
+            uint32_t float_count = reply.Get<uint32_t>();
+            delivered = (
+                reply.type == MessageType::TileResult &&
+                reply_job == job &&
+                float_count == tile_data.size());
+            if (delivered)
+                reply.GetBytes(tile_data.data(), tile_data.size() * sizeof(float));
+            delivered = delivered && reply.Ok();
+            if (delivered)
+            {
+                StoreTile(task, tile_data.data());
+                CompleteTile(*state, task, seconds, tile_data.size() * sizeof(float));
+                continue;
+            }
+        }
+
+        // The tile goes first so a lost worker delays it as little as possible
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->queue.push_front(task);
+            state->live_workers--;
+            state->last_worker_seen = std::chrono::steady_clock::now();
+            state->report.workers_lost++;
+            state->report.tiles_requeued++;
+        }
+        state->changed.notify_all();
+        CloseSocket(connection);
+        return;
+    }
+
+    MessageWriter shutdown(MessageType::Shutdown);
+    shutdown.Put(protocol_version);
+    shutdown.Send(connection);
+    CloseSocket(connection);
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->live_workers--;
+    }
+    state->changed.notify_all();
+}
+
+void TileCoordinator::StoreTile(const TileTask& task, const float* tile_data)
+{
+    const auto& tile = task.tile;
+    const auto& request = *task.request;
+    size_t resolution = request.height_data->GetResolution();
+    size_t texels = size_t(tile.width) * tile.height;
+
+    auto store = [&tile, resolution](CubemapData& data, const float* source, int channels) {
+        float* face = data.GetFaceDataPointer(tile.face);
+        for (int row = 0; row < tile.height; ++row)
+        {
+            std::memcpy(
+                face + ((tile.j0 + row) * resolution + tile.i0) * channels,
+                source + size_t(row) * tile.width * channels,
+                size_t(tile.width) * channels * sizeof(float));
+        }
+    };
+
+    store(*request.height_data, tile_data, 1);
+    tile_data += texels;
+    if (request.normal_data != nullptr)
+    {
+        store(*request.normal_data, tile_data, 3);
+        tile_data += 3 * texels;
+    }
+    store(*request.splat_data, tile_data, 4);
+}
+
+void TileCoordinator::CompleteTile(SharedState& state, const TileTask& task, double seconds, uint64_t bytes)
+{
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        task.request->remaining--;
+        state.outstanding_tiles--;
+        state.report.tiles_completed++;
+        state.report.worker_busy_seconds += seconds;
+        state.report.bytes_received += bytes;
+        if (state.outstanding_tiles == 0)
+        {
+            auto active = std::chrono::steady_clock::now() - state.active_since;
+            state.report.active_seconds += std::chrono::duration<double>(active).count();
+        }
+    }
+    state.changed.notify_all();
+}
+
+void TileCoordinator::GenerateTileLocally(SharedState& state, const TileTask& task)
+{
+    bool normals = task.request->normal_data != nullptr;
+    size_t texels = size_t(task.tile.width) * task.tile.height;
+    std::vector<float> tile_data(TileFloatCount(task.tile, normals));
+    float* normal_pointer = normals ? tile_data.data() + texels : nullptr;
+    float* splat_pointer = tile_data.data() + (normals ? 4 : 1) * texels;
+
+    GenerateTerrainTile(
+        task.tile,
+        task.request->height_data->GetResolution(),
+        task.request->parameters,
+        state.biome_table,
+        tile_data.data(),
+        normal_pointer,
+        splat_pointer);
+    StoreTile(task, tile_data.data());
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.report.tiles_generated_locally++;
+    }
+    CompleteTile(state, task, 0.0, 0);
+}
+
+void TileCoordinator::GenerateBaseMaps(
+    const TerrainNoiseParameters& parameters,
+    std::shared_ptr<CubemapData>& height_data,
+    std::shared_ptr<CubemapData>& normal_data,
+    std::shared_ptr<CubemapData>& splat_data)
+{
+    TERRAIN_PROFILE_SCOPE("GenerateBaseMaps");
+    auto request = std::make_shared<MapRequest>();
+    request->parameters = parameters;
+    request->height_data = height_data;
+    request->normal_data = normal_data;
+    request->splat_data = splat_data;
+
+    int resolution = height_data->GetResolution();
+    int tile_size = std::max(m_state->settings.tile_size, 1);
+    std::vector<TileTask> tasks;
+    for (int face_id = CubeFace::Begin; face_id < CubeFace::End; ++face_id)
+    {
+        for (int j0 = 0; j0 < resolution; j0 += tile_size)
+        {
+            for (int i0 = 0; i0 < resolution; i0 += tile_size)
+            {
+                TileTask task;
+                task.request = request;
+                task.tile.face = static_cast<CubeFace>(face_id);
+                task.tile.i0 = i0;
+                task.tile.j0 = j0;
+                task.tile.width = std::min(tile_size, resolution - i0);
+                task.tile.height = std::min(tile_size, resolution - j0);
+                tasks.push_back(task);
+            }
+        }
+    }
+
+    auto& state = *m_state;
+    std::unique_lock<std::mutex> lock(state.mutex);
+    if (state.outstanding_tiles == 0)
+        state.active_since = std::chrono::steady_clock::now();
+    state.outstanding_tiles += static_cast<int>(tasks.size());
+    request->remaining = static_cast<int>(tasks.size());
+    state.queue.insert(state.queue.end(), tasks.begin(), tasks.end());
+    state.changed.notify_all();
+
+    auto worker_wait = std::chrono::duration<double>(state.settings.worker_wait_seconds);
+    while (request->remaining > 0)
+    {
+        state.changed.wait_for(lock, std::chrono::milliseconds(100));
+        auto now = std::chrono::steady_clock::now();
+        if (state.live_workers > 0)
+        {
+            state.last_worker_seen = now;
+            continue;
+        }
+
+        // Nobody is left to take queued tiles, so the coordinator does them
+        if (state.queue.empty() || now - state.last_worker_seen < worker_wait)
+            continue;
+        TileTask task = state.queue.front();
+        state.queue.pop_front();
+        lock.unlock();
+        GenerateTileLocally(state, task);
+        lock.lock();
+    }
+}
+
+CoordinatorReport TileCoordinator::GetReport()
+{
+    std::lock_guard<std::mutex> lock(m_state->mutex);
+    return m_state->report;
+}
+
+
+//////////////////////////////
+// WORKER
+//////////////////////////////
+bool RunTileWorker(const std::string& host, int port, std::string& error)
+{
+    if (!InitializeSockets())
+    {
+        error = "Could not initialize sockets";
+        return false;
+    }
+
+    addrinfo hints{};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* addresses = nullptr;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0)
+    {
+        error = "Could not resolve " + host;
+        return false;
+    }
+
+    SocketHandle connection = invalid_socket;
+    for (addrinfo* address = addresses; address != nullptr; address = address->ai_next)
+    {
+        connection = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (connection == invalid_socket)
+            continue;
+        if (connect(connection, address->ai_addr, static_cast<int>(address->ai_addrlen)) == 0)
+            break;
+        CloseSocket(connection);
+        connection = invalid_socket;
+    }
+    freeaddrinfo(addresses);
+    if (connection == invalid_socket)
+    {
+        error = "Could not connect to " + host + ":" + std::to_string(port);
+        return false;
+    }
+    ConfigureSocket(connection);
+
+    MessageWriter hello(MessageType::Hello);
+    hello.Put(protocol_version);
+    if (!hello.Send(connection))
+    {
+        CloseSocket(connection);
+        error = "Lost the connection to the coordinator";
+        return false;
+    }
+
+    BiomeLookupTable biome_table(DefaultBiomeDefinitions());
+    std::vector<float> tile_data;
+    MessageReader message;
+    while (message.Receive(connection))
+    {
+        if (message.type == MessageType::Shutdown)
+        {
+            // Coordinators before the version reply send an empty shutdown
+            CloseSocket(connection);
+            uint32_t coordinator_version = message.Get<uint32_t>();
+            if (!message.Ok() || coordinator_version == protocol_version)
+                return true;
+            error = (
+                "Coordinator speaks protocol version " + std::to_string(coordinator_version) +
+                ", this worker speaks " + std::to_string(protocol_version));
+            return false;
+        }
+
+        uint64_t job = message.Get<uint64_t>();
+        int resolution = message.Get<int32_t>();
+        auto parameters = GetNoiseParameters(message);
+        CubemapTile tile;
+        tile.face = static_cast<CubeFace>(message.Get<int32_t>());
+        tile.i0 = message.Get<int32_t>();
+        tile.j0 = message.Get<int32_t>();
+        tile.width = message.Get<int32_t>();
+        tile.height = message.Get<int32_t>();
+        bool normals = message.Get<uint32_t>() != 0;
+
+        bool valid = (
+            message.type == MessageType::TileJob &&
+            message.Ok() &&
+            resolution > 0 && resolution <= max_job_resolution &&
+            tile.face >= CubeFace::Begin && tile.face < CubeFace::End &&
+            tile.i0 >= 0 && tile.j0 >= 0 && tile.width > 0 && tile.height > 0 &&
+            tile.i0 < resolution && tile.width <= resolution - tile.i0 &&
+            tile.j0 < resolution && tile.height <= resolution - tile.j0 &&
+            TileFloatCount(tile, normals) * sizeof(float) < max_payload_bytes);
+        if (!valid)
+        {
+            CloseSocket(connection);
+            error = "Malformed tile job from the coordinator";
+            return false;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        size_t texels = size_t(tile.width) * tile.height;
+        tile_data.resize(TileFloatCount(tile, normals));
+        GenerateTerrainTile(
+            tile,
+            resolution,
+            parameters,
+            biome_table,
+            tile_data.data(),
+            normals ? tile_data.data() + texels : nullptr,
+            tile_data.data() + (normals ? 4 : 1) * texels);
+        auto stop = std::chrono::steady_clock::now();
+
+        MessageWriter result(MessageType::TileResult);
+        result.Put(job);
+        result.Put(std::chrono::duration<float>(stop - start).count());
+        result.Put(static_cast<uint32_t>(tile_data.size()));
+        result.PutBytes(tile_data.data(), tile_data.size() * sizeof(float));
+        if (!result.Send(connection))
+            break;
+    }
+
+    CloseSocket(connection);
+    error = "Lost the connection to the coordinator";
+    return false;
+}
@@ -0,0 +1,145 @@
+#ifndef DISTRIBUTED_HPP
+#define DISTRIBUTED_HPP
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "terrain.hpp"
+
+
+struct CoordinatorSettings
+{
+    // Zero picks a free port, GetPort returns the one bound
+    int port = 0;
+    // Texels per side of one tile job
+    int tile_size = 128;
+    // A worker that has not returned its tile in this time is dropped and the tile requeued
+    double tile_timeout_seconds = 30.0;
+    // With no worker connected for this long the coordinator generates queued tiles itself
+    double worker_wait_seconds = 10.0;
+};
+
+struct CoordinatorReport
+{
+    int workers_connected = 0;
+    int workers_lost = 0;
+    int peak_workers = 0;
+    uint64_t tiles_completed = 0;
+    uint64_t tiles_requeued = 0;
+    uint64_t tiles_generated_locally = 0;
+    uint64_t bytes_received = 0;
+    // Tile generation time as measured on the workers
+    double worker_busy_seconds = 0.0;
+    // Wall time with at least one tile queued or in flight
+    double active_seconds = 0.0;
+
+    // Share of the peak worker count's time spent generating tiles
+    inline double ScalingEfficiency() const
+    {
+        double capacity = active_seconds * peak_workers;
+        return capacity > 0.0 ? worker_busy_seconds / capacity : 0.0;
+    }
+};
+
+
+/*
+Shards the pointwise stages of planet generation across worker processes.
+Workers connect over TCP and take one tile job at a time; each job carries
+the noise parameters and a face rectangle, and the worker answers with the
+tile's heights, splat weights and optionally normals. Tiles are written
+straight into the requesting planet's cubemaps.
+
+A worker that disconnects, times out or sends a malformed reply is dropped
+and its tile goes back to the front of the queue. Workers may join at any
+time. GenerateBaseMaps can be called from several threads at once, tiles
+of all planets share one queue.
+*/
+class TileCoordinator
+{
+    struct MapRequest;
+
+    struct TileTask
+    {
+        std::shared_ptr<MapRequest> request = nullptr;
+        CubemapTile tile;
+    };
+
+    struct SharedState
+    {
+        CoordinatorSettings settings;
+        BiomeLookupTable biome_table{ DefaultBiomeDefinitions() };
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::deque<TileTask> queue;
+        bool stopping = false;
+        int live_workers = 0;
+        int outstanding_tiles = 0;
+        std::chrono::steady_clock::time_point active_since;
+        std::chrono::steady_clock::time_point last_worker_seen;
+        CoordinatorReport report;
+    };
+
+    std::shared_ptr<SharedState> m_state;
+    std::vector<std::thread> m_threads;
+    std::mutex m_threads_mutex;
+    std::thread m_accept_thread;
+    uint64_t m_listen_socket;
+    int m_port = 0;
+
+public:
+    explicit TileCoordinator(const CoordinatorSettings& settings = CoordinatorSettings());
+
+    // Sends every worker a shutdown and waits for the connection threads
+    ~TileCoordinator();
+
+    TileCoordinator(const TileCoordinator&) = delete;
+    TileCoordinator& operator=(const TileCoordinator&) = delete;
+
+    // Binds and starts accepting workers, returns false and fills error on failure
+    bool Start(std::string& error);
+
+    inline int GetPort() const { return m_port; }
+
+    // Waits until count workers are connected, false on timeout
+    bool WaitForWorkers(int count, double timeout_seconds);
+
+    /*
+    Fills height, splat and, unless normal_data is null, normal maps from
+    worker tiles. Blocks until every tile of this planet has arrived.
+    */
+    void GenerateBaseMaps(
+        const TerrainNoiseParameters& parameters,
+        std::shared_ptr<CubemapData>& height_data,
+        std::shared_ptr<CubemapData>& normal_data,
+        std::shared_ptr<CubemapData>& splat_data);
+
+    CoordinatorReport GetReport();
+
+private:
+    void AcceptLoop();
+
+    static void ServeWorker(std::shared_ptr<SharedState> state, uint64_t socket);
+
+    // tile_data holds heights, then normals if requested, then splat weights
+    static void StoreTile(const TileTask& task, const float* tile_data);
+
+    static void CompleteTile(SharedState& state, const TileTask& task, double seconds, uint64_t bytes);
+
+    static void GenerateTileLocally(SharedState& state, const TileTask& task);
+};
+
+
+/*
+Worker side of the tile protocol. Connects to the coordinator, then
+generates tiles with the shared thread pool until the coordinator shuts it
+down or the connection drops. Returns false and fills error when the
+connection fails or the coordinator speaks another protocol version.
+*/
+bool RunTileWorker(const std::string& host, int port, std::string& error);
+
+#endif
@@ -0,0 +1,373 @@
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <utility>
+#include <vector>
+#include <glm/gtc/constants.hpp>
+#include "cubemap_geometry.hpp"
+#include "cubemap_view.hpp"
+#include "drainage.hpp"
+#include "horizon.hpp"
+#include "memory_arena.hpp"
+#include "parallel.hpp"
+#include "profiler.hpp"
+
+
+static inline bool IsCancelled(const std::atomic<bool>* cancel)
+{
+    return cancel != nullptr && cancel->load(std::memory_order_relaxed);
+}
+
+static const uint32_t no_receiver = std::numeric_limits<uint32_t>::max();
+
+// Counter clockwise from +i, axial neighbours at even k and diagonal ones at odd k
+static const int neighbour_di[8] = { 1, 1, 0, -1, -1, -1, 0, 1 };
+static const int neighbour_dj[8] = { 0, 1, 1, 1, 0, -1, -1, -1 };
+
+// Texels of all faces indexed as face * resolution^2 + j * resolution + i
+struct CubeTexelGrid
+{
+    int resolution;
+    uint32_t face_texels;
+    std::shared_ptr<CubemapGeometry> geometry;
+
+    CubeTexelGrid(int resolution) :
+        resolution(resolution),
+        face_texels(uint32_t(resolution) * resolution),
+        geometry(SharedCubemapGeometry(resolution))
+    {
+    }
+
+    inline uint32_t Index(int face_id, int i, int j) const
+    {
+        return face_id * face_texels + uint32_t(j) * resolution + i;
+    }
+
+    // Off the face the extended face plane is followed onto the neighbouring face
+    uint32_t Neighbour(uint32_t index, int k) const
+    {
+        int face_id = index / face_texels;
+        uint32_t texel = index % face_texels;
+        int i = texel % resolution + neighbour_di[k];
+        int j = texel / resolution + neighbour_dj[k];
+        if (i >= 0 && i < resolution && j >= 0 && j < resolution)
+            return Index(face_id, i, j);
+
+        auto point = CubemapData::CubePoint(CubemapCoordinates{
+            static_cast<CubeFace>(face_id),
+            (i + 0.5f) / resolution,
+            (j + 0.5f) / resolution });
+        auto coordinates = CubemapData::PointCoordinates(point);
+        return Index(
+            coordinates.face,
+            glm::clamp(int(coordinates.u * resolution), 0, resolution - 1),
+            glm::clamp(int(coordinates.v * resolution), 0, resolution - 1));
+    }
+
+    inline glm::vec3 Direction(uint32_t index) const
+    {
+        return geometry->Directions(static_cast<CubeFace>(index / face_texels)).Get(index % face_texels);
+    }
+};
+
+// Up to two lower neighbours and the share of flow sent to the first
+struct FlowReceivers
+{
+    uint32_t first = no_receiver;
+    uint32_t second = no_receiver;
+    float first_share = 1.0f;
+};
+
+static_assert(sizeof(FlowReceivers) == 3 * sizeof(float), "receivers are stored in float scratch buffers");
+
+// Working arrays of the flood and routing, taken from the terrain arena so its statistics include them
+struct DrainageScratch
+{
+    ScratchBuffer filled;
+    ScratchBuffer closed;
+    ScratchBuffer receivers;
+    ScratchBuffer order;
+    ScratchBuffer upstream;
+};
+
+static size_t ClosedFloatCount(uint32_t texel_count)
+{
+    return (size_t(texel_count) + sizeof(float) - 1) / sizeof(float);
+}
+
+static DrainageScratch AcquireDrainageScratch(uint32_t texel_count)
+{
+    auto& arena = SharedTerrainArena();
+    DrainageScratch scratch;
+    scratch.filled = arena.AcquireBuffer(texel_count);
+    scratch.closed = arena.AcquireBuffer(ClosedFloatCount(texel_count));
+    scratch.receivers = arena.AcquireBuffer(3 * size_t(texel_count));
+    scratch.order = arena.AcquireBuffer(texel_count);
+    scratch.upstream = arena.AcquireBuffer(texel_count);
+    return scratch;
+}
+
+static FlowReceivers RouteD8(const CubeTexelGrid& grid, const float* filled, uint32_t index)
+{
+    FlowReceivers receivers;
+    float steepest = 0.0f;
+    for (int k = 0; k < 8; ++k)
+    {
+        uint32_t neighbour = grid.Neighbour(index, k);
+        float slope = (filled[index] - filled[neighbour]) * (k % 2 == 0 ? 1.0f : glm::one_over_root_two<float>());
+        if (slope > steepest)
+        {
+            steepest = slope;
+            receivers.first = neighbour;
+        }
+    }
+    return receivers;
+}
+
+// Tarboton's facets, each between an axial and a diagonal neighbour
+static FlowReceivers RouteDInfinity(const CubeTexelGrid& grid, const float* filled, uint32_t index)
+{
+    const float quarter_pi = glm::quarter_pi<float>();
+    uint32_t neighbours[8];
+    for (int k = 0; k < 8; ++k)
+        neighbours[k] = grid.Neighbour(index, k);
+
+    FlowReceivers receivers;
+    float steepest = 0.0f;
+    for (int facet = 0; facet < 8; ++facet)
+    {
+        int axial = 2 * ((facet + 1) / 2) % 8;
+        int diagonal = facet % 2 == 0 ? facet + 1 : facet;
+        float center_height = filled[index];
+        float axial_height = filled[neighbours[axial]];
+        float diagonal_height = filled[neighbours[diagonal]];
+
+        // The facet angle is only needed once the facet is the steepest so far
+        float s1 = center_height - axial_height;
+        float s2 = axial_height - diagonal_height;
+        bool interior = s1 > 0.0f && s2 > 0.0f && s2 < s1;
+        float slope;
+        if (interior)
+            slope = glm::sqrt(s1 * s1 + s2 * s2);
+        else if (s2 <= 0.0f)
+            slope = s1;
+        else
+            slope = (center_height - diagonal_height) * glm::one_over_root_two<float>();
+        if (slope <= steepest)
+            continue;
+
+        steepest = slope;
+        float diagonal_share = interior ? std::atan2(s2, s1) / quarter_pi : (s2 <= 0.0f ? 0.0f : 1.0f);
+        if (diagonal_share >= 1.0f)
+        {
+            receivers.first = neighbours[diagonal];
+            receivers.second = no_receiver;
+            receivers.first_share = 1.0f;
+        }
+        else
+        {
+            receivers.first = neighbours[axial];
+            receivers.second = diagonal_share > 0.0f ? neighbours[diagonal] : no_receiver;
+            receivers.first_share = 1.0f - diagonal_share;
+        }
+    }
+    return receivers;
+}
+
+uint64_t DrainageScratchBytes(int resolution)
+{
+    uint32_t texel_count = 6 * uint32_t(resolution) * resolution;
+    size_t float_count =
+        3 * ScratchBufferSize(texel_count) +
+        ScratchBufferSize(ClosedFloatCount(texel_count)) +
+        ScratchBufferSize(3 * size_t(texel_count));
+    return float_count * sizeof(float);
+}
+
+void ComputeDrainage(
+    std::shared_ptr<CubemapData>& height_data,
+    std::shared_ptr<CubemapData>& flow_data,
+    std::shared_ptr<CubemapData>& lake_data,
+    const DrainageSettings& settings,
+    const std::atomic<bool>* cancel)
+{
+    TERRAIN_PROFILE_SCOPE("ComputeDrainage");
+    int resolution = height_data->GetResolution();
+    CubeTexelGrid grid(resolution);
+    uint32_t texel_count = 6 * grid.face_texels;
+
+    // Pooled memory holds stale values, every array is written before it is read
+    auto scratch = AcquireDrainageScratch(texel_count);
+    float* filled = scratch.filled.data();
+    auto* closed = reinterpret_cast<uint8_t*>(scratch.closed.data());
+    auto* receivers = reinterpret_cast<FlowReceivers*>(scratch.receivers.data());
+    auto* order = reinterpret_cast<uint32_t*>(scratch.order.data());
+    float* upstream = scratch.upstream.data();
+
+    // Each land texel starts with the texel the flood reached it from as its receiver.
+    // Sea texels and the outlet keep none
+    ConstCubemapView<1> heights(*height_data);
+    ParallelFor(6 * resolution, [&](int row) {
+        auto face = static_cast<CubeFace>(row / resolution);
+        int j = row % resolution;
+        const float* height_row = heights.Row(face, j);
+        for (int i = 0; i < resolution; ++i)
+        {
+            uint32_t index = grid.Index(face, i, j);
+            filled[index] = height_row[i];
+            closed[index] = filled[index] < settings.sea_level;
+            receivers[index] = FlowReceivers();
+        }
+    });
+
+    // Land texels in the order the flood reached them, so in increasing filled height
+    uint32_t order_count = 0;
+    {
+        TERRAIN_PROFILE_SCOPE("ComputeDrainage/Flood");
+        using Entry = std::pair<float, uint32_t>;
+        std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> open;
+
+        // Only sea texels on the coast can reach land
+        uint32_t lowest = 0;
+        for (uint32_t index = 0; index < texel_count; ++index)
+        {
+            if (filled[index] < filled[lowest])
+                lowest = index;
+            if (!closed[index])
+                continue;
+            for (int k = 0; k < 8; ++k)
+            {
+                if (!closed[grid.Neighbour(index, k)])
+                {
+                    open.emplace(filled[index], index);
+                    break;
+                }
+            }
+        }
+        if (open.empty() && !closed[lowest])
+        {
+            closed[lowest] = 1;
+            open.emplace(filled[lowest], lowest);
+        }
+
+        uint64_t popped = 0;
+        while (!open.empty())
+        {
+            if (++popped % 65536 == 0 && IsCancelled(cancel))
+                return;
+            auto entry = open.top();
+            open.pop();
+            float level = entry.first;
+            uint32_t index = entry.second;
+            if (level >= settings.sea_level)
+                order[order_count++] = index;
+
+            float raised = std::nextafter(level, std::numeric_limits<float>::infinity());
+            for (int k = 0; k < 8; ++k)
+            {
+                uint32_t neighbour = grid.Neighbour(index, k);
+                if (closed[neighbour])
+                    continue;
+                closed[neighbour] = 1;
+                filled[neighbour] = glm::max(filled[neighbour], raised);
+                receivers[neighbour].first = index;
+                open.emplace(filled[neighbour], neighbour);
+            }
+        }
+    }
+
+    {
+        TERRAIN_PROFILE_SCOPE("ComputeDrainage/Routing");
+        ParallelFor(6 * resolution, [&](int row) {
+            if (IsCancelled(cancel))
+                return;
+            auto face = static_cast<CubeFace>(row / resolution);
+            int j = row % resolution;
+            TERRAIN_PROFILE_COUNT(TexelsProcessed, resolution);
+            const float* height_row = heights.Row(face, j);
+            for (int i = 0; i < resolution; ++i)
+            {
+                uint32_t index = grid.Index(face, i, j);
+                if (height_row[i] < settings.sea_level)
+                    continue;
+                FlowReceivers routed;
+                if (settings.routing == FlowRouting::DInfinity)
+                    routed = RouteDInfinity(grid, filled, index);
+                if (routed.first == no_receiver)
+                    routed = RouteD8(grid, filled, index);
+
+                // Neighbours across a face edge are not symmetric, so a texel there can
+                // see no lower neighbour and keeps its strictly lower flood parent
+                if (routed.first != no_receiver)
+                    receivers[index] = routed;
+            }
+        });
+        if (IsCancelled(cancel))
+            return;
+    }
+
+    // Upstream area in units of the mean texel area, so corner texels count for less than center ones
+    float mean_solid_angle = grid.geometry->MeanSolidAngle();
+    for (int face_id = CubeFace::Begin; face_id < CubeFace::End; ++face_id)
+    {
+        const auto& solid_angles = grid.geometry->SolidAngles(static_cast<CubeFace>(face_id));
+        for (uint32_t texel = 0; texel < grid.face_texels; ++texel)
+            upstream[face_id * grid.face_texels + texel] = solid_angles[texel] / mean_solid_angle;
+    }
+
+    // Receivers are strictly lower, so they were reached earlier and are visited later here
+    {
+        TERRAIN_PROFILE_SCOPE("ComputeDrainage/Accumulate");
+        for (uint32_t k = order_count; k-- > 0;)
+        {
+            uint32_t index = order[k];
+            const auto& flow = receivers[index];
+            if (flow.first != no_receiver)
+                upstream[flow.first] += flow.first_share * upstream[index];
+            if (flow.second != no_receiver)
+                upstream[flow.second] += (1.0f - flow.first_share) * upstream[index];
+        }
+    }
+
+    float log_texel_count = std::log(float(texel_count));
+    CubemapView<float, 3> flows(*flow_data);
+    CubemapView<float, 1> lakes(*lake_data);
+    ParallelFor(6 * resolution, [&](int row) {
+        if (IsCancelled(cancel))
+            return;
+        auto face = static_cast<CubeFace>(row / resolution);
+        int j = row % resolution;
+        const float* height_row = heights.Row(face, j);
+        glm::vec3* flow_row = flows.Row(face, j);
+        float* lake_row = lakes.Row(face, j);
+        for (int i = 0; i < resolution; ++i)
+        {
+            uint32_t index = grid.Index(face, i, j);
+            const auto& flow = receivers[index];
+
+            glm::vec2 direction(0.0f);
+            if (flow.first != no_receiver)
+            {
+                glm::vec3 position = grid.Direction(index);
+                glm::vec3 downhill = flow.first_share * (grid.Direction(flow.first) - position);
+                if (flow.second != no_receiver)
+                    downhill += (1.0f - flow.first_share) * (grid.Direction(flow.second) - position);
+
+                glm::vec3 east, north;
+                HorizonTangentFrame(position, east, north);
+                direction = glm::vec2(glm::dot(downhill, east), glm::dot(downhill, north));
+                float length = glm::sqrt(glm::dot(direction, direction));
+                if (length > 0.0f)
+                    direction /= length;
+            }
+
+            float height = height_row[i];
+            flow_row[i] = glm::vec3(
+                std::log(glm::max(upstream[index], 1.0f)) / log_texel_count,
+                0.5f * (direction.x + 1.0f),
+                0.5f * (direction.y + 1.0f));
+            lake_row[i] = height < settings.sea_level ? 0.0f : filled[index] - height;
+        }
+    });
+}
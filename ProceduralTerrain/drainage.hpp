@@ -0,0 +1,53 @@
+#ifndef DRAINAGE_HPP
+#define DRAINAGE_HPP
+#include <Merlin/Render/cubemap_data.hpp>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+using namespace Merlin;
+
+
+enum class FlowRouting
+{
+    D8,
+    DInfinity
+};
+
+struct DrainageSettings
+{
+    FlowRouting routing = FlowRouting::DInfinity;
+    // Texels below sea level are outlets, the default matches the default water level
+    float sea_level = 0.5f;
+};
+
+/*
+Fills depressions and routes water over the whole planet.
+A priority flood grows inwards from the coast over all six faces, with
+neighbours across face edges found along the extended face plane. Every
+texel it reaches is raised to just above the texel it was reached from,
+so the filled surface always drains to the sea. Without any sea the lowest
+texel is the single outlet. The flood runs on one thread and takes most of
+the time at high resolutions.
+
+Flow leaves each land texel towards its steepest filled neighbour (D8) or
+is split between the two neighbours of the steepest facet (D-infinity),
+and upstream area is accumulated in decreasing filled height order. Areas
+are texel solid angles in units of the mean texel, so they are correct
+over the whole sphere.
+
+flow_data (3 channels): log(upstream area) / log(all texels), then the
+flow direction in the HorizonTangentFrame stored as 0.5 (x + 1).
+lake_data (1 channel): fill depth, non-zero where a depression became a lake.
+*/
+void ComputeDrainage(
+    std::shared_ptr<CubemapData>& height_data,
+    std::shared_ptr<CubemapData>& flow_data,
+    std::shared_ptr<CubemapData>& lake_data,
+    const DrainageSettings& settings = DrainageSettings(),
+    const std::atomic<bool>* cancel = nullptr);
+
+// Arena memory ComputeDrainage holds while it runs, the flood's open queue aside
+uint64_t DrainageScratchBytes(int resolution);
+
+#endif
@@ -3,30 +3,85 @@
 #include <imgui.h>
 #include <Merlin/Render/material.hpp>
 #include <Merlin/Core/logger.hpp>
+#include <algorithm>
+#include <cstdint>
 #include <functional>
+#include "profiler.hpp"
+#include "terrain_shading.hpp"
+#include "regeneration.hpp"
+#include "memory_arena.hpp"
+
+
+/*
+Forwards batched uniform uploads to a Merlin material.
+Merlin materials take uniforms by name, so a location here indexes the
+names resolved for the current material and the upload reuses the stored
+string. The material is the program, replacing it re-resolves every name.
+*/
+class MaterialUniformTarget : public UniformTarget
+{
+    std::shared_ptr<Material> m_material = nullptr;
+    std::vector<std::string> m_names;
+
+public:
+    MaterialUniformTarget(const std::shared_ptr<Material>& material) :
+        m_material(material)
+    {
+    }
+
+    uint64_t GetProgramId() const override
+    {
+        return static_cast<uint64_t>(reinterpret_cast<uintptr_t>(m_material.get()));
+    }
+
+    int GetUniformLocation(const std::string& name) override
+    {
+        auto existing = std::find(m_names.begin(), m_names.end(), name);
+        if (existing != m_names.end())
+            return static_cast<int>(existing - m_names.begin());
+        m_names.push_back(name);
+        return static_cast<int>(m_names.size() - 1);
+    }
+
+    void SetUniformFloat(int location, float value) override
+    {
+        m_material->SetUniformFloat(m_names[location], value);
+    }
+
+    void SetUniformFloat3(int location, const glm::vec3& value) override
+    {
+        m_material->SetUniformFloat3(m_names[location], value);
+    }
+};
 
 
 class EditorWindow
 {
     const float settings_width = 300.0f;
     const float element_width = 150.0f;
-    float texture_scales[4]{ 2.5f, 2.5f, 2.5f, 2.5f };
-    float water_scale = 0.08;
-    float water_speed = 0.1f;
-    float water_level = 0.5f;
-    float water_depth_scale = 0.017f;
-    glm::vec3 water_shallow_color{ 0.0f / 256.0, 64.0f / 256.0f, 89.0 / 256.0f };
-    glm::vec3 water_deep_color{ 0.0f / 256.0, 28.0f / 256.0f, 34.0 / 256.0f };
+    TerrainShadingSettings shading;
+    PlanetConfig generation_config;
 
     ImVec2 viewport_size{ 0.0f, 0.0f };
 
-    std::shared_ptr<Material> m_material = nullptr;
+    const std::string trace_path = "terrain_trace.json";
+    const double profile_refresh_seconds = 0.5;
+    ProfileSummary profile_summary;
+    double profile_refresh_time = -1.0e9;
+
+    std::shared_ptr<TerrainShadingUniforms> m_uniforms = nullptr;
+    std::shared_ptr<TerrainRegenerator> m_regenerator = nullptr;
 
 public:
     const ImVec2& GetViewportSize() { return viewport_size; }
 
-    EditorWindow(const std::shared_ptr<Material>& material) :
-        m_material(material)
+    EditorWindow(
+        const std::shared_ptr<TerrainShadingUniforms>& uniforms,
+        const std::shared_ptr<TerrainRegenerator>& regenerator,
+        const PlanetConfig& config) :
+        generation_config(config),
+        m_uniforms(uniforms),
+        m_regenerator(regenerator)
     {
     }
 
@@ -66,6 +121,18 @@ public:
                 ImGui::EndTabItem();
             }
 
+            if (ImGui::BeginTabItem("Terrain Generation"))
+            {
+                DrawGenerationTab();
+                ImGui::EndTabItem();
+            }
+
+            if (ImGui::BeginTabItem("Profiler"))
+            {
+                DrawProfilerTab();
+                ImGui::EndTabItem();
+            }
+
             ImGui::EndTabBar();
         }
         ImGui::EndChild();
@@ -103,27 +170,27 @@ private:
     {
         ImGui::Separator();
         ImGui::SetNextItemWidth(element_width);
-        ImGui::ColorPicker4("Shallow Water Color", &water_shallow_color.x);
+        ImGui::ColorPicker3("Shallow Water Color", &shading.water_shallow_color.x);
 
         ImGui::Separator();
         ImGui::SetNextItemWidth(element_width);
-        ImGui::ColorPicker4("Deep Water Color", &water_deep_color.x);
+        ImGui::ColorPicker3("Deep Water Color", &shading.water_deep_color.x);
 
         ImGui::Separator();
         ImGui::SetNextItemWidth(element_width);
-        ImGui::SliderFloat("Water Level", &water_level, 0.3f, 0.8f);
+        ImGui::SliderFloat("Water Level", &shading.water_level, 0.3f, 0.8f);
 
         ImGui::Separator();
         ImGui::SetNextItemWidth(element_width);
-        ImGui::SliderFloat("Water Depth Scale", &water_depth_scale, 0.0f, 0.05f);
+        ImGui::SliderFloat("Water Depth Scale", &shading.water_depth_scale, 0.0f, 0.05f);
 
         ImGui::Separator();
         ImGui::SetNextItemWidth(element_width);
-        ImGui::SliderFloat("Water Wave Speed", &water_speed, 0.0f, 0.3f);
+        ImGui::SliderFloat("Water Wave Speed", &shading.water_speed, 0.0f, 0.3f);
 
         ImGui::Separator();
         ImGui::SetNextItemWidth(element_width);
-        ImGui::SliderFloat("Water Texture Scale", &water_scale, 0.01f, 0.5f);
+        ImGui::SliderFloat("Water Texture Scale", &shading.water_scale, 0.01f, 0.5f);
 
         ImGui::Separator();
     }
@@ -132,39 +199,184 @@ private:
     {
         ImGui::Separator();
         ImGui::SetNextItemWidth(element_width);
-        ImGui::SliderFloat("Texture0 Scale", &texture_scales[0], 0.001f, 10.0f);
+        ImGui::SliderFloat("Texture0 Scale", &shading.texture_scales[0], 0.001f, 10.0f);
+
+        ImGui::Separator();
+        ImGui::SetNextItemWidth(element_width);
+        ImGui::SliderFloat("Texture1 Scale", &shading.texture_scales[1], 0.001f, 10.0f);
+
+        ImGui::Separator();
+        ImGui::SetNextItemWidth(element_width);
+        ImGui::SliderFloat("Texture2 Scale", &shading.texture_scales[2], 0.001f, 10.0f);
+
+        ImGui::Separator();
+        ImGui::SetNextItemWidth(element_width);
+        ImGui::SliderFloat("Texture3 Scale", &shading.texture_scales[3], 0.001f, 10.0f);
+
+        ImGui::Separator();
+        ImGui::SetNextItemWidth(element_width);
+        ImGui::SliderFloat("Shadow Softness", &shading.shadow_softness, 0.001f, 0.2f);
+
+        ImGui::Separator();
+        ImGui::SetNextItemWidth(element_width);
+        ImGui::SliderFloat("Ambient Occlusion", &shading.ambient_occlusion, 0.0f, 1.0f);
+
+        ImGui::Separator();
+        ImGui::Checkbox("Two Material Splat", &shading.two_material_splat);
+
+        ImGui::Separator();
+    }
+
+    // Edits only queue a request, the regenerator debounces and runs it off the UI thread
+    void DrawGenerationTab()
+    {
+        auto& noise = generation_config.noise;
+        bool changed = false;
+
+        ImGui::Separator();
+        int seed = static_cast<int>(noise.seed);
+        ImGui::SetNextItemWidth(element_width);
+        if (ImGui::InputInt("Seed", &seed))
+        {
+            noise.seed = static_cast<uint32_t>(std::max(seed, 0));
+            changed = true;
+        }
+
+        ImGui::Separator();
+        ImGui::SetNextItemWidth(element_width);
+        changed |= ImGui::SliderFloat("Base Frequency", &noise.base_frequency, 0.5f, 8.0f);
 
         ImGui::Separator();
         ImGui::SetNextItemWidth(element_width);
-        ImGui::SliderFloat("Texture1 Scale", &texture_scales[1], 0.001f, 10.0f);
+        changed |= ImGui::SliderInt("Octaves", &noise.octaves, 1, 10);
 
         ImGui::Separator();
         ImGui::SetNextItemWidth(element_width);
-        ImGui::SliderFloat("Texture2 Scale", &texture_scales[2], 0.001f, 10.0f);
+        changed |= ImGui::SliderFloat("Persistence", &noise.persistence, 0.1f, 0.9f);
 
         ImGui::Separator();
         ImGui::SetNextItemWidth(element_width);
-        ImGui::SliderFloat("Texture3 Scale", &texture_scales[3], 0.001f, 10.0f);
+        changed |= ImGui::SliderFloat("Lacunarity", &noise.frequency_multiplier, 1.5f, 3.0f);
+
+        ImGui::Separator();
+        ImGui::SetNextItemWidth(element_width);
+        changed |= ImGui::SliderFloat("Height Scale", &noise.height_scale, 0.0f, 0.1f);
+
+        ImGui::Separator();
+        ImGui::SetNextItemWidth(element_width);
+        changed |= ImGui::SliderInt("Erosion Steps", &generation_config.erosion_steps, 0, 20000);
+        changed |= ImGui::Checkbox("Multigrid Erosion", &generation_config.multigrid_erosion);
+
+        ImGui::Separator();
+        ImGui::SetNextItemWidth(element_width);
+        changed |= ImGui::SliderInt("Smooth Iterations", &generation_config.smooth_iterations, 0, 8);
+
+        if (changed && m_regenerator != nullptr)
+            m_regenerator->Request(generation_config);
+
+        ImGui::Separator();
+        if (m_regenerator != nullptr)
+        {
+            auto status = m_regenerator->GetStatus();
+            const char* state = status.running ? "Generating" : (status.pending ? "Waiting for edits" : "Idle");
+            ImGui::Text("Status: %s", state);
+            ImGui::Text("Last generation: %.1f ms", 1000.0 * status.last_seconds);
+            ImGui::Text(
+                "Critical path: %.1f ms, %d of %d stages reused",
+                1000.0 * status.last_critical_path_seconds,
+                status.last_stages_reused,
+                status.last_stage_count);
+            ImGui::Text(
+                "Completed %llu, cancelled %llu",
+                (unsigned long long)status.completed,
+                (unsigned long long)status.cancelled);
+        }
+        auto arena = SharedTerrainArena().GetStatistics();
+        ImGui::Text(
+            "Arena: %.1f MB in use, %.1f MB peak",
+            arena.bytes_in_use / (1024.0 * 1024.0),
+            arena.high_water_bytes / (1024.0 * 1024.0));
+        ImGui::Separator();
+    }
 
+    void DrawProfilerTab()
+    {
+#ifndef PROCEDURAL_TERRAIN_PROFILING
+        ImGui::TextWrapped(
+            "Profiling is compiled out. "
+            "Configure with PROCEDURAL_TERRAIN_ENABLE_PROFILING=ON to record zones.");
+#else
         ImGui::Separator();
+        if (ImGui::Button("Export Trace"))
+            Profiler::WriteChromeTrace(trace_path);
+        ImGui::SameLine();
+        if (ImGui::Button("Reset"))
+        {
+            Profiler::Reset();
+            profile_refresh_time = -1.0e9;
+        }
+
+        // Summaries are refreshed a few times a second rather than every frame
+        double time = ImGui::GetTime();
+        if (time - profile_refresh_time >= profile_refresh_seconds)
+        {
+            profile_summary = Profiler::GetSummary();
+            profile_refresh_time = time;
+        }
+        const auto& summary = profile_summary;
+
+        ImGui::Separator();
+        ImGui::Text("%-24s %6s %9s %8s", "Zone", "Calls", "Total ms", "Max ms");
+        for (const auto& zone : summary.zones)
+        {
+            ImGui::Text(
+                "%-24.24s %6llu %9.2f %8.2f",
+                zone.name.c_str(),
+                (unsigned long long)zone.calls,
+                zone.total_ms,
+                zone.max_ms);
+        }
+
+        ImGui::Separator();
+        double max_busy_ms = 0.0;
+        double total_busy_ms = 0.0;
+        ImGui::Text("%-8s %9s %12s %12s", "Thread", "Busy ms", "Texels", "Particles");
+        for (const auto& thread : summary.threads)
+        {
+            ImGui::Text(
+                "%-8u %9.2f %12llu %12llu",
+                thread.thread_id,
+                thread.busy_ms,
+                (unsigned long long)thread.counters[size_t(ProfileCounter::TexelsProcessed)],
+                (unsigned long long)thread.counters[size_t(ProfileCounter::ParticlesUpdated)]);
+            max_busy_ms = std::max(max_busy_ms, thread.busy_ms);
+            total_busy_ms += thread.busy_ms;
+        }
+        if (!summary.threads.empty() && total_busy_ms > 0.0)
+        {
+            double mean_busy_ms = total_busy_ms / summary.threads.size();
+            ImGui::Text("Imbalance (max / mean busy): %.2f", max_busy_ms / mean_busy_ms);
+        }
+
+        ImGui::Separator();
+        for (size_t k = 0; k < summary.counters.size(); ++k)
+        {
+            ImGui::Text(
+                "%-24s %14llu",
+                ProfileCounterName(static_cast<ProfileCounter>(k)),
+                (unsigned long long)summary.counters[k]);
+        }
+        ImGui::Separator();
+#endif
     }
 
+    // Values are uploaded by the scene layer's flush, unchanged ones are skipped
     void SetMaterialProperties()
     {
-        if (m_material == nullptr)
+        if (m_uniforms == nullptr)
             return;
 
-        m_material->SetUniformFloat3("u_water_shallow_color", water_shallow_color);
-        m_material->SetUniformFloat3("u_water_deep_color", water_deep_color);
-        m_material->SetUniformFloat("u_water_level", water_level);
-        m_material->SetUniformFloat("u_water_depth_scale", water_depth_scale);
-        m_material->SetUniformFloat("u_water_speed", water_speed);
-        m_material->SetUniformFloat("u_water_scale", water_scale);
-
-        m_material->SetUniformFloat("u_terrain_texture_scales[0]", texture_scales[0]);
-        m_material->SetUniformFloat("u_terrain_texture_scales[1]", texture_scales[1]);
-        m_material->SetUniformFloat("u_terrain_texture_scales[2]", texture_scales[2]);
-        m_material->SetUniformFloat("u_terrain_texture_scales[3]", texture_scales[3]);
+        m_uniforms->SetSettings(shading);
     }
 
 };
@@ -1,15 +1,47 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
 #include <glm/gtc/random.hpp>
 #include "erosion.hpp"
 #include "cube_sphere.hpp"
+#include "profiler.hpp"
 
 
+// Version 2 measures the reference change weighted by texel area, version 3 stores the channel count
+static const char checkpoint_magic[8] = { 'P', 'T', 'E', 'R', 'O', 'D', 'E', '3' };
+
+
+ErosionParameters DefaultErosionParameters(int resolution)
+{
+    float grid_spacing = 1.0f / resolution;
+    ErosionParameters parameters;
+    parameters.concentration_factor = 3.0f;
+    parameters.erosion_time = 0.5f;
+    parameters.evaporation_time = 1.0f;
+    parameters.friction_time = 0.5;
+    parameters.particle_start_volume = 0.8f * grid_spacing * grid_spacing;
+    return parameters;
+}
+
 void Deposit(
     Merlin::CubemapData& heightmap,
     glm::vec3 position,
     glm::vec2 direction,
     float amount)
 {
-    auto coordinates = CubemapData::PointCoordinates(position);
+    Deposit(heightmap, CubemapData::PointCoordinates(position), direction, amount);
+}
+
+void Deposit(
+    Merlin::CubemapData& heightmap,
+    Merlin::CubemapCoordinates coordinates,
+    glm::vec2 direction,
+    float amount)
+{
+    // Texels are addressed as single floats below
+    if (heightmap.GetChannelCount() != 1)
+        throw std::invalid_argument("Erosion needs a single channel heightmap");
     int resolution = heightmap.GetResolution();
 
     int i0 = (int)(coordinates.u * resolution - 0.5);
@@ -57,24 +89,30 @@ void Deposit(
         w01 = amount * 0.5 * w.y;
     }
 
-    heightmap.GetPixel(coordinates.face, i0, j0, 0) += w00;
-    heightmap.GetPixel(coordinates.face, i0, j1, 0) += w01;
-    heightmap.GetPixel(coordinates.face, i1, j0, 0) += w10;
-    heightmap.GetPixel(coordinates.face, i1, j1, 0) += w11;
+    // Only one face is touched, so its rows are addressed directly
+    TERRAIN_PROFILE_COUNT(Deposits, 1);
+    float* row0 = heightmap.GetFaceDataPointer(coordinates.face) + size_t(j0) * resolution;
+    float* row1 = heightmap.GetFaceDataPointer(coordinates.face) + size_t(j1) * resolution;
+    row0[i0] += w00;
+    row1[i0] += w01;
+    row0[i1] += w10;
+    row1[i1] += w11;
 }
 
-void UpdateParticle(
+float UpdateParticle(
     ErosionParticle& particle,
     Merlin::CubemapData& heightmap,
     const ErosionParameters& parameters)
 {
-    // Evaluate local surface geometry
+    TERRAIN_PROFILE_COUNT(ParticlesUpdated, 1);
+
+    // Evaluate local surface geometry, converting the position to cubemap coordinates once
     glm::vec3 original_position = particle.position;
     auto original_coordinates = CubemapData::PointCoordinates(original_position);
     float original_altitude = BilinearInterpolate(heightmap, original_coordinates, 0);
     glm::vec3 sphere_normal = glm::normalize(original_position);
-    glm::vec3 eu = SphereHeightmapUTangent(original_position, heightmap);
-    glm::vec3 ev = SphereHeightmapVTangent(original_position, heightmap);
+    glm::vec3 eu, ev;
+    SphereHeightmapTangents(original_coordinates, original_altitude, heightmap, eu, ev);
     glm::vec3 surface_normal = glm::normalize(-glm::cross(eu, ev)); // Cubemap uses LH coordinates!!!
     glm::vec3 gravity_direction = (
         surface_normal - glm::dot(surface_normal, sphere_normal) * sphere_normal);
@@ -125,14 +163,17 @@ void UpdateParticle(
         slope > 0.0 ?
         glm::min(d_height, 0.9f * slope * spacing) :
         glm::max(d_height, 0.9f * slope * spacing));
-    Deposit(heightmap, particle.position, grid_direction, d_height);
+    Deposit(heightmap, new_coordinates, grid_direction, d_height);
 
     // Reset Particles
     bool needs_reset = (particle.volume < 1.0e-3 * parameters.particle_start_volume);
     if (needs_reset)
+    {
+        TERRAIN_PROFILE_COUNT(ParticleResets, 1);
         InitializeParticle(particle, parameters);
+    }
 
-
+    return d_height;
 }
 
 void InitializeParticle(
@@ -145,4 +186,104 @@ void InitializeParticle(
         glm::vec3(-1.0f),
         glm::vec3(+1.0f)));
     particle.velocity = glm::vec3(0.0f);
-}
\ No newline at end of file
+}
+
+bool SaveErosionCheckpoint(
+    const std::string& path,
+    Merlin::CubemapData& heightmap,
+    const ErosionCheckpoint& checkpoint)
+{
+    // Write to a temporary file first so an interrupted save keeps the old checkpoint
+    std::string temporary_path = path + ".tmp";
+    {
+        std::ofstream file(temporary_path, std::ios::binary);
+        if (!file)
+            return false;
+
+        uint32_t resolution = heightmap.GetResolution();
+        uint32_t channels = heightmap.GetChannelCount();
+        uint32_t n_particles = static_cast<uint32_t>(checkpoint.particles.size());
+        file.write(checkpoint_magic, sizeof(checkpoint_magic));
+        file.write(reinterpret_cast<const char*>(&resolution), sizeof(resolution));
+        file.write(reinterpret_cast<const char*>(&channels), sizeof(channels));
+        file.write(reinterpret_cast<const char*>(&checkpoint.step), sizeof(checkpoint.step));
+        file.write(reinterpret_cast<const char*>(&checkpoint.reference_change), sizeof(checkpoint.reference_change));
+        file.write(reinterpret_cast<const char*>(&n_particles), sizeof(n_particles));
+
+        size_t face_size = size_t(resolution) * resolution * channels * sizeof(float);
+        for (int face_id = CubeFace::Begin; face_id < CubeFace::End; ++face_id)
+        {
+            auto face = static_cast<CubeFace>(face_id);
+            file.write(reinterpret_cast<const char*>(heightmap.GetFaceDataPointer(face)), face_size);
+        }
+        for (const auto& particle : checkpoint.particles)
+        {
+            float state[8] = {
+                particle.position.x, particle.position.y, particle.position.z,
+                particle.velocity.x, particle.velocity.y, particle.velocity.z,
+                particle.volume, particle.soil_fraction };
+            file.write(reinterpret_cast<const char*>(state), sizeof(state));
+        }
+        if (!file)
+            return false;
+    }
+
+    std::remove(path.c_str());
+    return std::rename(temporary_path.c_str(), path.c_str()) == 0;
+}
+
+bool LoadErosionCheckpoint(
+    const std::string& path,
+    Merlin::CubemapData& heightmap,
+    ErosionCheckpoint& checkpoint)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+
+    char magic[sizeof(checkpoint_magic)];
+    uint32_t resolution = 0;
+    uint32_t channels = 0;
+    uint32_t n_particles = 0;
+    ErosionCheckpoint loaded;
+    file.read(magic, sizeof(magic));
+    file.read(reinterpret_cast<char*>(&resolution), sizeof(resolution));
+    file.read(reinterpret_cast<char*>(&channels), sizeof(channels));
+    file.read(reinterpret_cast<char*>(&loaded.step), sizeof(loaded.step));
+    file.read(reinterpret_cast<char*>(&loaded.reference_change), sizeof(loaded.reference_change));
+    file.read(reinterpret_cast<char*>(&n_particles), sizeof(n_particles));
+    if (!file ||
+        std::memcmp(magic, checkpoint_magic, sizeof(magic)) != 0 ||
+        resolution != heightmap.GetResolution() ||
+        channels != heightmap.GetChannelCount())
+        return false;
+
+    // Read everything before touching the heightmap so a truncated file changes nothing
+    size_t face_count = size_t(resolution) * resolution * channels;
+    std::vector<float> height_values(6 * face_count);
+    file.read(reinterpret_cast<char*>(height_values.data()), height_values.size() * sizeof(float));
+
+    loaded.particles.resize(n_particles);
+    for (auto& particle : loaded.particles)
+    {
+        float state[8];
+        file.read(reinterpret_cast<char*>(state), sizeof(state));
+        particle.position = glm::vec3(state[0], state[1], state[2]);
+        particle.velocity = glm::vec3(state[3], state[4], state[5]);
+        particle.volume = state[6];
+        particle.soil_fraction = state[7];
+    }
+    if (!file)
+        return false;
+
+    for (int face_id = CubeFace::Begin; face_id < CubeFace::End; ++face_id)
+    {
+        auto face = static_cast<CubeFace>(face_id);
+        std::memcpy(
+            heightmap.GetFaceDataPointer(face),
+            height_values.data() + face_id * face_count,
+            face_count * sizeof(float));
+    }
+    checkpoint = std::move(loaded);
+    return true;
+}
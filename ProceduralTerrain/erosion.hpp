@@ -1,5 +1,8 @@
 #ifndef EROSION_HPP
 #define EROSION_HPP
+#include <atomic>
+#include <string>
+#include <vector>
 #include <glm/glm.hpp>
 #include "Merlin/Render/cubemap_data.hpp"
 
@@ -14,6 +17,10 @@ struct ErosionParameters
 };
 
 
+// Parameters for a heightmap of the given resolution, volumes scale with the texel area
+ErosionParameters DefaultErosionParameters(int resolution);
+
+
 struct ErosionParticle
 {
     glm::vec3 position;
@@ -31,13 +38,69 @@ struct ErosionParticle
 };
 
 
+/*
+Controls how long an erosion run lasts.
+With a convergence_tolerance above zero the run stops early once the texel
+area weighted absolute height change over one convergence interval drops
+below convergence_tolerance times the change seen over the first interval.
+Each check costs a pass over the whole map, zero runs all max_steps without
+checking. A checkpoint_interval of zero disables checkpoints.
+Setting *cancel stops the run after the current step.
+*/
+struct ErosionRunSettings
+{
+    int n_particles = 1000;
+    int max_steps = 10000;
+    int convergence_interval = 250;
+    float convergence_tolerance = 0.0f;
+    int checkpoint_interval = 0;
+    std::string checkpoint_path;
+    bool resume_from_checkpoint = false;
+    const std::atomic<bool>* cancel = nullptr;
+};
+
+
+/*
+Coarse to fine erosion.
+The heightmap is box filtered down by factors of two until n_levels exist
+or the resolution reaches min_resolution. The coarsest level is eroded for
+coarse_steps, then each finer level receives the upsampled height change of
+the level below it and is refined for refinement_steps.
+*/
+struct MultigridErosionSettings
+{
+    int n_levels = 4;
+    int min_resolution = 32;
+    int coarse_steps = 10000;
+    int refinement_steps = 500;
+    ErosionRunSettings level_settings;
+};
+
+
+struct ErosionCheckpoint
+{
+    int step = 0;
+    double reference_change = 0.0;
+    std::vector<ErosionParticle> particles;
+};
+
+
+// Throws std::invalid_argument unless the heightmap has a single channel
 void Deposit(
     Merlin::CubemapData& heightmap,
     glm::vec3 position,
     glm::vec2 direction,
     float amount);
 
-void UpdateParticle(
+// Same as above for a position whose cubemap coordinates are already known
+void Deposit(
+    Merlin::CubemapData& heightmap,
+    Merlin::CubemapCoordinates coordinates,
+    glm::vec2 direction,
+    float amount);
+
+// Returns the height change deposited onto the heightmap
+float UpdateParticle(
     ErosionParticle& particle,
     Merlin::CubemapData& heightmap,
     const ErosionParameters& parameters);
@@ -46,4 +109,15 @@ void InitializeParticle(
     ErosionParticle& particle,
     const ErosionParameters& parameters);
 
+// Checkpoints store the heightmap and the particle state, loading fails on a resolution or channel mismatch
+bool SaveErosionCheckpoint(
+    const std::string& path,
+    Merlin::CubemapData& heightmap,
+    const ErosionCheckpoint& checkpoint);
+
+bool LoadErosionCheckpoint(
+    const std::string& path,
+    Merlin::CubemapData& heightmap,
+    ErosionCheckpoint& checkpoint);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,349 @@
+#include <cmath>
+#include <vector>
+#include <glm/gtc/constants.hpp>
+#include "horizon.hpp"
+#include "cubemap_view.hpp"
+#include "memory_arena.hpp"
+#include "parallel.hpp"
+#include "profiler.hpp"
+
+
+static inline bool IsCancelled(const std::atomic<bool>* cancel)
+{
+    return cancel != nullptr && cancel->load(std::memory_order_relaxed);
+}
+
+// Face plane point of padded texel (x, y) is origin + x * axis_x + y * axis_y
+struct PaddedFacePlane
+{
+    glm::vec3 origin;
+    glm::vec3 axis_x;
+    glm::vec3 axis_y;
+
+    inline glm::vec3 Point(int x, int y) const
+    {
+        return origin + float(x) * axis_x + float(y) * axis_y;
+    }
+};
+
+static PaddedFacePlane MakePaddedFacePlane(CubeFace face, int resolution, int padding)
+{
+    glm::vec3 corner = CubemapData::CubePoint(CubemapCoordinates{ face, 0.0f, 0.0f });
+    glm::vec3 u_edge = CubemapData::CubePoint(CubemapCoordinates{ face, 1.0f, 0.0f }) - corner;
+    glm::vec3 v_edge = CubemapData::CubePoint(CubemapCoordinates{ face, 0.0f, 1.0f }) - corner;
+
+    PaddedFacePlane plane;
+    plane.axis_x = u_edge / float(resolution);
+    plane.axis_y = v_edge / float(resolution);
+    plane.origin = corner + (0.5f - padding) * (plane.axis_x + plane.axis_y);
+    return plane;
+}
+
+/*
+Radii of each face extended by padding texels on every side, followed by
+2x2 max levels. The padding is sampled from the neighbouring faces along
+the extended face plane, so marches cross face edges without seams.
+*/
+struct HeightPyramid
+{
+    int padding = 0;
+    std::vector<int> widths;
+    std::vector<size_t> offsets;
+    size_t face_floats = 0;
+    ScratchBuffer buffer;
+
+    inline const float* Level(int face_id, int level) const
+    {
+        return buffer.data() + face_id * face_floats + offsets[level];
+    }
+
+    inline float* Level(int face_id, int level)
+    {
+        return buffer.data() + face_id * face_floats + offsets[level];
+    }
+};
+
+static void BuildHeightPyramid(
+    CubemapData& height_data,
+    const PaddedFacePlane* planes,
+    int padding,
+    int level_count,
+    HeightPyramid& pyramid)
+{
+    TERRAIN_PROFILE_SCOPE("BakeHorizonMap/Pyramid");
+    int resolution = height_data.GetResolution();
+    pyramid.padding = padding;
+    pyramid.widths.assign(1, resolution + 2 * padding);
+    pyramid.offsets.assign(1, 0);
+    pyramid.face_floats = size_t(pyramid.widths[0]) * pyramid.widths[0];
+    for (int level = 1; level < level_count; ++level)
+    {
+        int width = (pyramid.widths.back() + 1) / 2;
+        pyramid.widths.push_back(width);
+        pyramid.offsets.push_back(pyramid.face_floats);
+        pyramid.face_floats += size_t(width) * width;
+    }
+    pyramid.buffer = SharedTerrainArena().AcquireBuffer(6 * pyramid.face_floats);
+
+    int base_width = pyramid.widths[0];
+    ConstCubemapView<1> heights(height_data);
+    ParallelFor(6 * base_width, [&](int row) {
+        int face_id = row / base_width;
+        int y = row % base_width;
+        auto face = static_cast<CubeFace>(face_id);
+        float* radii = pyramid.Level(face_id, 0) + size_t(y) * base_width;
+        int j = y - padding;
+        bool row_inside = j >= 0 && j < resolution;
+        const float* height_row = row_inside ? heights.Row(face, j) : nullptr;
+        for (int x = 0; x < base_width; ++x)
+        {
+            int i = x - padding;
+            float height;
+            if (row_inside && i >= 0 && i < resolution)
+                height = height_row[i];
+            else
+                height = BilinearInterpolate(
+                    height_data,
+                    CubemapData::PointCoordinates(planes[face_id].Point(x, y)),
+                    0);
+            radii[x] = 0.5f + height;
+        }
+    });
+
+    for (int level = 1; level < level_count; ++level)
+    {
+        int width = pyramid.widths[level];
+        int fine_width = pyramid.widths[level - 1];
+        ParallelFor(6 * width, [&, level, width, fine_width](int row) {
+            int face_id = row / width;
+            int y = row % width;
+            const float* fine = pyramid.Level(face_id, level - 1);
+            float* coarse = pyramid.Level(face_id, level) + size_t(y) * width;
+            const float* fine_row0 = fine + size_t(2 * y) * fine_width;
+            const float* fine_row1 = fine + size_t(glm::min(2 * y + 1, fine_width - 1)) * fine_width;
+            for (int x = 0; x < width; ++x)
+            {
+                int x0 = 2 * x;
+                int x1 = glm::min(2 * x + 1, fine_width - 1);
+                coarse[x] = glm::max(
+                    glm::max(fine_row0[x0], fine_row0[x1]),
+                    glm::max(fine_row1[x0], fine_row1[x1]));
+            }
+        });
+    }
+}
+
+
+struct HorizonStep
+{
+    int dx;
+    int dy;
+    int level;
+    float offset_sq;
+};
+
+struct HorizonAzimuth
+{
+    float cos_angle;
+    float sin_angle;
+    std::vector<HorizonStep> steps;
+};
+
+// Texel offsets along one face plane direction, each reading the pyramid level no wider than its step
+static HorizonAzimuth MakeHorizonAzimuth(float angle, int radius, float step_growth, int max_level)
+{
+    HorizonAzimuth azimuth;
+    azimuth.cos_angle = std::cos(angle);
+    azimuth.sin_angle = std::sin(angle);
+
+    float distance = 1.0f;
+    while (distance <= radius)
+    {
+        float next = glm::max(distance + 1.0f, distance * step_growth);
+        int level = 0;
+        while (level < max_level && float(2 << level) <= next - distance)
+            level++;
+
+        HorizonStep step;
+        step.dx = static_cast<int>(std::lround(distance * azimuth.cos_angle));
+        step.dy = static_cast<int>(std::lround(distance * azimuth.sin_angle));
+        step.level = level;
+        step.offset_sq = float(step.dx * step.dx + step.dy * step.dy);
+        if (azimuth.steps.empty() || step.dx != azimuth.steps.back().dx || step.dy != azimuth.steps.back().dy)
+            azimuth.steps.push_back(step);
+        distance = next;
+    }
+    return azimuth;
+}
+
+// Largest radius within radius texels of (x, y), read from the cells of one pyramid level
+static float WindowMaxRadius(const float* level_data, int width, int level, int x, int y, int radius)
+{
+    float window_max = 0.0f;
+    for (int cell_y = (y - radius) >> level; cell_y <= (y + radius) >> level; ++cell_y)
+        for (int cell_x = (x - radius) >> level; cell_x <= (x + radius) >> level; ++cell_x)
+            window_max = glm::max(window_max, level_data[cell_y * width + cell_x]);
+    return window_max;
+}
+
+// Least squares a + b c + d s through the samples, given sums of the normal equations
+static glm::vec3 SolveHarmonicFit(const glm::vec3 columns[3], const glm::vec3& rhs)
+{
+    float determinant = glm::dot(columns[0], glm::cross(columns[1], columns[2]));
+    if (glm::abs(determinant) < 1.0e-6f)
+        return glm::vec3(rhs.x / columns[0].x, 0.0f, 0.0f);
+    return glm::vec3(
+        glm::dot(rhs, glm::cross(columns[1], columns[2])),
+        glm::dot(columns[0], glm::cross(rhs, columns[2])),
+        glm::dot(columns[0], glm::cross(columns[1], rhs))) / determinant;
+}
+
+void BakeHorizonMap(
+    std::shared_ptr<CubemapData>& height_data,
+    std::shared_ptr<CubemapData>& horizon_data,
+    const HorizonBakeSettings& settings,
+    const std::atomic<bool>* cancel)
+{
+    TERRAIN_PROFILE_SCOPE("BakeHorizonMap");
+    int resolution = height_data->GetResolution();
+    int radius = glm::max(1, static_cast<int>(std::ceil(settings.search_radius * resolution)));
+
+    // Early out bounds read at most 5x5 cells of the window level
+    int window_level = 0;
+    while (4 * (1 << window_level) < 2 * radius + 1)
+        window_level++;
+
+    PaddedFacePlane planes[6];
+    for (int face_id = CubeFace::Begin; face_id < CubeFace::End; ++face_id)
+        planes[face_id] = MakePaddedFacePlane(static_cast<CubeFace>(face_id), resolution, radius);
+
+    HeightPyramid pyramid;
+    BuildHeightPyramid(*height_data, planes, radius, window_level + 1, pyramid);
+    if (IsCancelled(cancel))
+        return;
+
+    int azimuth_count = glm::max(settings.azimuth_count, 3);
+    float step_growth = glm::max(settings.step_growth, 1.0f);
+    std::vector<HorizonAzimuth> azimuths;
+    for (int k = 0; k < azimuth_count; ++k)
+    {
+        float angle = 2.0f * glm::pi<float>() * k / azimuth_count;
+        azimuths.push_back(MakeHorizonAzimuth(angle, radius, step_growth, window_level));
+    }
+
+    int tile_size = glm::max(settings.tile_size, 1);
+    int tiles_per_side = (resolution + tile_size - 1) / tile_size;
+    int tiles_per_face = tiles_per_side * tiles_per_side;
+    CubemapView<float, 4> horizons(*horizon_data);
+    auto work = [&](int task) {
+        if (IsCancelled(cancel))
+            return;
+        int face_id = task / tiles_per_face;
+        int tile = task % tiles_per_face;
+        auto face = static_cast<CubeFace>(face_id);
+        TERRAIN_PROFILE_SCOPE_ARG("BakeHorizonMap/Tile", face);
+
+        const PaddedFacePlane& plane = planes[face_id];
+        const float* levels[32];
+        for (int level = 0; level <= window_level; ++level)
+            levels[level] = pyramid.Level(face_id, level);
+        const int* widths = pyramid.widths.data();
+
+        // Face axes are orthogonal and equally long
+        float axis_length_sq = glm::dot(plane.axis_x, plane.axis_x);
+
+        int i_begin = (tile % tiles_per_side) * tile_size;
+        int j_begin = (tile / tiles_per_side) * tile_size;
+        int i_end = glm::min(i_begin + tile_size, resolution);
+        int j_end = glm::min(j_begin + tile_size, resolution);
+        TERRAIN_PROFILE_COUNT(TexelsProcessed, uint64_t(i_end - i_begin) * (j_end - j_begin));
+        for (int j = j_begin; j < j_end; ++j)
+        {
+            glm::vec4* horizon_row = horizons.Row(face, j);
+            for (int i = i_begin; i < i_end; ++i)
+            {
+                int x = i + radius;
+                int y = j + radius;
+                glm::vec3 texel_point = plane.Point(x, y);
+                float point_length = glm::length(texel_point);
+                glm::vec3 direction = texel_point / point_length;
+                float texel_radius = levels[0][y * widths[0] + x];
+                float window_radius = WindowMaxRadius(
+                    levels[window_level], widths[window_level], window_level, x, y, radius);
+
+                // The squared length of a sample's plane point and its projection on direction
+                // are quadratic and affine in the texel offset
+                float point_length_sq = point_length * point_length;
+                float length_x = 2.0f * glm::dot(texel_point, plane.axis_x);
+                float length_y = 2.0f * glm::dot(texel_point, plane.axis_y);
+                float along_x = glm::dot(plane.axis_x, direction);
+                float along_y = glm::dot(plane.axis_y, direction);
+
+                float texel_radius_sq = texel_radius * texel_radius;
+                float window_sq_sum = window_radius * window_radius + texel_radius_sq;
+                float window_cross = 2.0f * window_radius * texel_radius;
+
+                glm::vec3 east, north;
+                HorizonTangentFrame(direction, east, north);
+
+                glm::vec3 columns[3]{ glm::vec3(0.0f), glm::vec3(0.0f), glm::vec3(0.0f) };
+                glm::vec3 rhs(0.0f);
+                float visibility = 0.0f;
+                for (const auto& azimuth : azimuths)
+                {
+                    // Sine of the highest elevation seen, terrain below the tangent plane never occludes
+                    float horizon = 0.0f;
+                    if (window_radius > texel_radius)
+                    {
+                        for (const auto& step : azimuth.steps)
+                        {
+                            float dx = float(step.dx);
+                            float dy = float(step.dy);
+                            float length_sq = point_length_sq + dx * length_x + dy * length_y + step.offset_sq * axis_length_sq;
+                            float cos_angle = (point_length + dx * along_x + dy * along_y) * glm::inversesqrt(length_sq);
+
+                            // Later samples are farther, so the window maximum only sinks below the horizon
+                            float bound_rise = window_radius * cos_angle - texel_radius;
+                            if (bound_rise <= 0.0f ||
+                                bound_rise * bound_rise <= horizon * horizon * (window_sq_sum - window_cross * cos_angle))
+                                break;
+
+                            int level = step.level;
+                            int sx = x + step.dx;
+                            int sy = y + step.dy;
+                            float sample_radius = levels[level][(sy >> level) * widths[level] + (sx >> level)];
+                            float rise = sample_radius * cos_angle - texel_radius;
+                            if (rise <= 0.0f)
+                                continue;
+                            float distance_sq = sample_radius * (sample_radius - 2.0f * texel_radius * cos_angle) + texel_radius_sq;
+                            if (rise * rise > horizon * horizon * distance_sq)
+                                horizon = rise * glm::inversesqrt(distance_sq);
+                        }
+                    }
+
+                    // Azimuth of the face plane direction in the tangent frame
+                    glm::vec3 tangent = azimuth.cos_angle * plane.axis_x + azimuth.sin_angle * plane.axis_y;
+                    tangent -= glm::dot(tangent, direction) * direction;
+                    glm::vec3 basis(1.0f, glm::dot(tangent, east), glm::dot(tangent, north));
+                    float tangent_length = glm::sqrt(basis.y * basis.y + basis.z * basis.z);
+                    basis.y /= tangent_length;
+                    basis.z /= tangent_length;
+
+                    columns[0] += basis.x * basis;
+                    columns[1] += basis.y * basis;
+                    columns[2] += basis.z * basis;
+                    rhs += horizon * basis;
+                    visibility += 1.0f - horizon * horizon;
+                }
+
+                glm::vec3 fit = SolveHarmonicFit(columns, rhs);
+                horizon_row[i] = glm::vec4(
+                    visibility / azimuth_count,
+                    glm::clamp(fit.x, 0.0f, 1.0f),
+                    0.5f * (glm::clamp(fit.y, -1.0f, 1.0f) + 1.0f),
+                    0.5f * (glm::clamp(fit.z, -1.0f, 1.0f) + 1.0f));
+            }
+        }
+    };
+    ParallelFor(6 * tiles_per_face, work);
+}
@@ -0,0 +1,55 @@
+#ifndef HORIZON_HPP
+#define HORIZON_HPP
+#include <Merlin/Render/cubemap_data.hpp>
+#include <atomic>
+#include <memory>
+#include <glm/glm.hpp>
+
+using namespace Merlin;
+
+
+struct HorizonBakeSettings
+{
+    int azimuth_count = 8;
+    // Search radius as a fraction of the face width
+    float search_radius = 0.125f;
+    // Ratio between successive march distances
+    float step_growth = 1.25f;
+    // Texels per side of one pool task
+    int tile_size = 32;
+};
+
+/*
+East/north frame the horizon harmonics are stored in.
+cube_sphere.frag builds the same frame, the two must stay in sync.
+*/
+inline void HorizonTangentFrame(const glm::vec3& direction, glm::vec3& east, glm::vec3& north)
+{
+    glm::vec3 up = glm::abs(direction.y) < 0.999f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+    east = glm::normalize(glm::cross(up, direction));
+    north = glm::cross(direction, east);
+}
+
+/*
+Bakes terrain self shadowing into a 4 channel cubemap.
+Each texel marches outwards along azimuth_count great circles, which are
+straight lines in the face plane, so faces are padded with their
+neighbours' heights and marched in texel space. Steps grow geometrically
+and read a max height pyramid level about as wide as the step, so thin
+ridges between samples still occlude. A march stops once the highest
+terrain in its search window could not rise above the horizon found.
+
+Horizons are sines of elevation above the tangent plane, clamped at zero.
+Channel 0 holds cosine weighted sky visibility for ambient occlusion.
+Channels 1 to 3 hold a least squares fit a + b cos(phi) + c sin(phi) of
+the horizon over the azimuth phi in the HorizonTangentFrame, with b and c
+stored as 0.5 (x + 1), so the shader gets the horizon toward the light
+from a single fetch.
+*/
+void BakeHorizonMap(
+    std::shared_ptr<CubemapData>& height_data,
+    std::shared_ptr<CubemapData>& horizon_data,
+    const HorizonBakeSettings& settings = HorizonBakeSettings(),
+    const std::atomic<bool>* cancel = nullptr);
+
+#endif
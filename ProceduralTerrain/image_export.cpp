@@ -0,0 +1,442 @@
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <numeric>
+#include <vector>
+#include <glm/gtc/constants.hpp>
+#include "image_export.hpp"
+#include "parallel.hpp"
+#include "profiler.hpp"
+
+
+const char* ImageFormatExtension(ImageFormat format)
+{
+    switch (format)
+    {
+    case ImageFormat::Png16: return "png";
+    case ImageFormat::Exr: return "exr";
+    default: return "";
+    }
+}
+
+
+//////////////////////////////
+// BYTE HELPERS
+//////////////////////////////
+static void AppendBigEndian32(std::vector<uint8_t>& bytes, uint32_t value)
+{
+    bytes.push_back(uint8_t(value >> 24));
+    bytes.push_back(uint8_t(value >> 16));
+    bytes.push_back(uint8_t(value >> 8));
+    bytes.push_back(uint8_t(value));
+}
+
+template<typename T>
+static void AppendLittleEndian(std::vector<uint8_t>& bytes, T value)
+{
+    uint64_t bits = 0;
+    std::memcpy(&bits, &value, sizeof(T));
+    for (size_t k = 0; k < sizeof(T); ++k)
+        bytes.push_back(uint8_t(bits >> (8 * k)));
+}
+
+static void AppendString(std::vector<uint8_t>& bytes, const std::string& text)
+{
+    bytes.insert(bytes.end(), text.begin(), text.end());
+    bytes.push_back(0);
+}
+
+static uint32_t Crc32(uint32_t crc, const uint8_t* data, size_t size)
+{
+    static const auto table = []() {
+        std::array<uint32_t, 256> entries{};
+        for (uint32_t n = 0; n < 256; ++n)
+        {
+            uint32_t c = n;
+            for (int k = 0; k < 8; ++k)
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            entries[n] = c;
+        }
+        return entries;
+    }();
+
+    crc = ~crc;
+    for (size_t k = 0; k < size; ++k)
+        crc = table[(crc ^ data[k]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+
+//////////////////////////////
+// PNG
+//////////////////////////////
+/*
+Each row goes out as its own IDAT chunk holding stored deflate blocks, so
+rows can be written as they arrive and no compressor is needed.
+*/
+class PngRowWriter : public ImageRowWriter
+{
+    std::ofstream m_file;
+    int m_width;
+    int m_height;
+    int m_channels;
+    int m_rows_written = 0;
+    uint32_t m_adler_a = 1;
+    uint32_t m_adler_b = 0;
+    std::vector<uint8_t> m_row;
+    std::vector<uint8_t> m_chunk;
+
+public:
+    PngRowWriter(const std::string& path, int width, int height, int channels) :
+        m_file(path, std::ios::binary),
+        m_width(width),
+        m_height(height),
+        m_channels(channels)
+    {
+        static const uint8_t color_types[] = { 0, 4, 2, 6 };
+        static const uint8_t signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+        m_file.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+
+        std::vector<uint8_t> header;
+        AppendBigEndian32(header, width);
+        AppendBigEndian32(header, height);
+        header.push_back(16);
+        header.push_back(color_types[channels - 1]);
+        header.push_back(0);
+        header.push_back(0);
+        header.push_back(0);
+        WriteChunk("IHDR", header);
+    }
+
+    bool IsOpen() const { return m_file.good(); }
+
+    bool WriteRow(const float* row) override
+    {
+        // Filter type 0 followed by big endian samples
+        size_t sample_count = size_t(m_width) * m_channels;
+        m_row.resize(1 + 2 * sample_count);
+        m_row[0] = 0;
+        for (size_t k = 0; k < sample_count; ++k)
+        {
+            auto value = uint16_t(glm::clamp(row[k], 0.0f, 1.0f) * 65535.0f + 0.5f);
+            m_row[1 + 2 * k] = uint8_t(value >> 8);
+            m_row[2 + 2 * k] = uint8_t(value);
+        }
+
+        // Adler-32 of the uncompressed stream, reduced often enough to stay in 32 bits
+        for (size_t start = 0; start < m_row.size(); start += 4096)
+        {
+            size_t end = std::min(m_row.size(), start + 4096);
+            for (size_t k = start; k < end; ++k)
+            {
+                m_adler_a += m_row[k];
+                m_adler_b += m_adler_a;
+            }
+            m_adler_a %= 65521;
+            m_adler_b %= 65521;
+        }
+
+        m_chunk.clear();
+        if (m_rows_written == 0)
+        {
+            m_chunk.push_back(0x78);
+            m_chunk.push_back(0x01);
+        }
+        bool last_row = m_rows_written + 1 == m_height;
+        for (size_t start = 0; start < m_row.size(); start += 65535)
+        {
+            auto length = uint16_t(std::min<size_t>(65535, m_row.size() - start));
+            bool final_block = last_row && start + length == m_row.size();
+            m_chunk.push_back(final_block ? 1 : 0);
+            AppendLittleEndian<uint16_t>(m_chunk, length);
+            AppendLittleEndian<uint16_t>(m_chunk, uint16_t(~length));
+            m_chunk.insert(m_chunk.end(), m_row.begin() + start, m_row.begin() + start + length);
+        }
+        if (last_row)
+            AppendBigEndian32(m_chunk, (m_adler_b << 16) | m_adler_a);
+
+        WriteChunk("IDAT", m_chunk);
+        m_rows_written++;
+        return m_file.good();
+    }
+
+    bool Finish() override
+    {
+        WriteChunk("IEND", {});
+        m_file.close();
+        return m_rows_written == m_height && !m_file.fail();
+    }
+
+private:
+    void WriteChunk(const char* type, const std::vector<uint8_t>& data)
+    {
+        std::vector<uint8_t> length;
+        AppendBigEndian32(length, uint32_t(data.size()));
+        m_file.write(reinterpret_cast<const char*>(length.data()), 4);
+
+        uint32_t crc = Crc32(0, reinterpret_cast<const uint8_t*>(type), 4);
+        crc = Crc32(crc, data.data(), data.size());
+        m_file.write(type, 4);
+        m_file.write(reinterpret_cast<const char*>(data.data()), data.size());
+
+        std::vector<uint8_t> checksum;
+        AppendBigEndian32(checksum, crc);
+        m_file.write(reinterpret_cast<const char*>(checksum.data()), 4);
+    }
+};
+
+
+//////////////////////////////
+// EXR
+//////////////////////////////
+/*
+Single part scanline file with 32 bit float channels and no compression.
+Every scanline has the same size, so the offset table is written up front.
+*/
+class ExrRowWriter : public ImageRowWriter
+{
+    std::ofstream m_file;
+    int m_width;
+    int m_height;
+    int m_channels;
+    int m_rows_written = 0;
+    std::vector<int> m_channel_order;
+    std::vector<uint8_t> m_line;
+
+public:
+    ExrRowWriter(const std::string& path, int width, int height, int channels) :
+        m_file(path, std::ios::binary),
+        m_width(width),
+        m_height(height),
+        m_channels(channels)
+    {
+        static const std::vector<std::vector<std::string>> channel_names{
+            { "Y" }, { "Y", "A" }, { "R", "G", "B" }, { "R", "G", "B", "A" } };
+        const auto& names = channel_names[channels - 1];
+
+        // Channels are stored in alphabetical order of their names
+        m_channel_order.resize(channels);
+        std::iota(m_channel_order.begin(), m_channel_order.end(), 0);
+        std::sort(m_channel_order.begin(), m_channel_order.end(), [&names](int a, int b) {
+            return names[a] < names[b];
+        });
+
+        std::vector<uint8_t> header{ 0x76, 0x2F, 0x31, 0x01, 2, 0, 0, 0 };
+        auto attribute = [&header](const std::string& name, const std::string& type, const std::vector<uint8_t>& value) {
+            AppendString(header, name);
+            AppendString(header, type);
+            AppendLittleEndian<int32_t>(header, int32_t(value.size()));
+            header.insert(header.end(), value.begin(), value.end());
+        };
+
+        std::vector<uint8_t> channel_list;
+        for (int channel : m_channel_order)
+        {
+            AppendString(channel_list, names[channel]);
+            AppendLittleEndian<int32_t>(channel_list, 2);
+            AppendLittleEndian<int32_t>(channel_list, 0);
+            AppendLittleEndian<int32_t>(channel_list, 1);
+            AppendLittleEndian<int32_t>(channel_list, 1);
+        }
+        channel_list.push_back(0);
+        attribute("channels", "chlist", channel_list);
+        attribute("compression", "compression", { 0 });
+
+        std::vector<uint8_t> window;
+        AppendLittleEndian<int32_t>(window, 0);
+        AppendLittleEndian<int32_t>(window, 0);
+        AppendLittleEndian<int32_t>(window, width - 1);
+        AppendLittleEndian<int32_t>(window, height - 1);
+        attribute("dataWindow", "box2i", window);
+        attribute("displayWindow", "box2i", window);
+        attribute("lineOrder", "lineOrder", { 0 });
+
+        std::vector<uint8_t> value;
+        AppendLittleEndian<float>(value, 1.0f);
+        attribute("pixelAspectRatio", "float", value);
+        attribute("screenWindowWidth", "float", value);
+        value.clear();
+        AppendLittleEndian<float>(value, 0.0f);
+        AppendLittleEndian<float>(value, 0.0f);
+        attribute("screenWindowCenter", "v2f", value);
+        header.push_back(0);
+
+        uint64_t line_size = 8 + uint64_t(width) * channels * sizeof(float);
+        uint64_t first_line = header.size() + uint64_t(height) * sizeof(uint64_t);
+        for (int y = 0; y < height; ++y)
+            AppendLittleEndian<uint64_t>(header, first_line + y * line_size);
+        m_file.write(reinterpret_cast<const char*>(header.data()), header.size());
+    }
+
+    bool IsOpen() const { return m_file.good(); }
+
+    bool WriteRow(const float* row) override
+    {
+        m_line.clear();
+        AppendLittleEndian<int32_t>(m_line, m_rows_written);
+        AppendLittleEndian<int32_t>(m_line, int32_t(size_t(m_width) * m_channels * sizeof(float)));
+        for (int channel : m_channel_order)
+            for (int x = 0; x < m_width; ++x)
+                AppendLittleEndian<float>(m_line, row[size_t(x) * m_channels + channel]);
+
+        m_file.write(reinterpret_cast<const char*>(m_line.data()), m_line.size());
+        m_rows_written++;
+        return m_file.good();
+    }
+
+    bool Finish() override
+    {
+        m_file.close();
+        return m_rows_written == m_height && !m_file.fail();
+    }
+};
+
+
+std::unique_ptr<ImageRowWriter> ImageRowWriter::Create(
+    ImageFormat format,
+    const std::string& path,
+    int width,
+    int height,
+    int channels)
+{
+    if (channels < 1 || channels > 4 || width < 1 || height < 1)
+        return nullptr;
+
+    if (format == ImageFormat::Png16)
+    {
+        auto writer = std::make_unique<PngRowWriter>(path, width, height, channels);
+        return writer->IsOpen() ? std::move(writer) : nullptr;
+    }
+    auto writer = std::make_unique<ExrRowWriter>(path, width, height, channels);
+    return writer->IsOpen() ? std::move(writer) : nullptr;
+}
+
+
+//////////////////////////////
+// EXPORT
+//////////////////////////////
+// Fills bands of rows in parallel and streams them to the writer in order
+template<typename FillRow>
+static bool StreamRows(ImageRowWriter& writer, int width, int height, int channels, const FillRow& fill_row)
+{
+    const int band_rows = 64;
+    size_t row_size = size_t(width) * channels;
+    std::vector<float> band(band_rows * row_size);
+    for (int band_start = 0; band_start < height; band_start += band_rows)
+    {
+        int row_count = std::min(band_rows, height - band_start);
+        ParallelFor(row_count, [&](int k) {
+            fill_row(band_start + k, band.data() + k * row_size);
+        });
+        for (int k = 0; k < row_count; ++k)
+        {
+            if (!writer.WriteRow(band.data() + k * row_size))
+                return false;
+        }
+    }
+    return writer.Finish();
+}
+
+bool ExportCubemapFaces(
+    CubemapData& data,
+    int channels,
+    const std::string& path_prefix,
+    ImageFormat format)
+{
+    TERRAIN_PROFILE_SCOPE("ExportCubemapFaces");
+    static const char* face_names[] = { "px", "nx", "py", "ny", "pz", "nz" };
+    int resolution = data.GetResolution();
+    if (channels > static_cast<int>(data.GetChannelCount()))
+        return false;
+
+    // The channel count is only known at run time, so rows are copied with the map's own stride
+    size_t stride = data.GetChannelCount();
+    std::array<bool, 6> written{};
+    ParallelFor(6, [&](int face_id) {
+        auto face = static_cast<CubeFace>(face_id);
+        std::string path = path_prefix + "_" + face_names[face_id] + "." + ImageFormatExtension(format);
+        auto writer = ImageRowWriter::Create(format, path, resolution, resolution, channels);
+        if (writer == nullptr)
+            return;
+
+        const float* face_data = data.GetFaceDataPointer(face);
+        written[face_id] = StreamRows(*writer, resolution, resolution, channels, [&](int j, float* row) {
+            const float* source = face_data + size_t(j) * resolution * stride;
+            for (int i = 0; i < resolution; ++i)
+                for (int channel = 0; channel < channels; ++channel)
+                    row[i * channels + channel] = source[i * stride + channel];
+        });
+    });
+
+    return std::all_of(written.begin(), written.end(), [](bool ok) { return ok; });
+}
+
+bool ExportEquirectangular(
+    CubemapData& data,
+    int channels,
+    const std::string& path,
+    ImageFormat format,
+    int width)
+{
+    TERRAIN_PROFILE_SCOPE("ExportEquirectangular");
+    if (channels > static_cast<int>(data.GetChannelCount()))
+        return false;
+    int height = std::max(width / 2, 1);
+    auto writer = ImageRowWriter::Create(format, path, width, height, channels);
+    if (writer == nullptr)
+        return false;
+
+    // Longitude terms are shared by every row
+    std::vector<float> sin_longitude(width);
+    std::vector<float> cos_longitude(width);
+    for (int x = 0; x < width; ++x)
+    {
+        float longitude = glm::two_pi<float>() * (x + 0.5f) / width - glm::pi<float>();
+        sin_longitude[x] = glm::sin(longitude);
+        cos_longitude[x] = glm::cos(longitude);
+    }
+
+    int resolution = data.GetResolution();
+    size_t stride = data.GetChannelCount();
+    std::array<const float*, 6> faces;
+    for (int face_id = CubeFace::Begin; face_id < CubeFace::End; ++face_id)
+        faces[face_id] = data.GetFaceDataPointer(static_cast<CubeFace>(face_id));
+
+    return StreamRows(*writer, width, height, channels, [&](int y, float* row) {
+        TERRAIN_PROFILE_COUNT(TexelsProcessed, width);
+        float latitude = glm::half_pi<float>() - glm::pi<float>() * (y + 0.5f) / height;
+        float sin_latitude = glm::sin(latitude);
+        float cos_latitude = glm::cos(latitude);
+        for (int x = 0; x < width; ++x)
+        {
+            glm::vec3 direction(
+                cos_latitude * sin_longitude[x],
+                sin_latitude,
+                cos_latitude * cos_longitude[x]);
+            auto coordinates = CubemapData::PointCoordinates(direction);
+
+            // Bilinear weights between texel centres, clamped to the face, are shared by all channels
+            float u = glm::clamp(coordinates.u * resolution - 0.5f, 0.0f, resolution - 1.0f);
+            float v = glm::clamp(coordinates.v * resolution - 0.5f, 0.0f, resolution - 1.0f);
+            int i0 = static_cast<int>(u);
+            int j0 = static_cast<int>(v);
+            int i1 = std::min(i0 + 1, resolution - 1);
+            int j1 = std::min(j0 + 1, resolution - 1);
+            float fu = u - i0;
+            float fv = v - j0;
+            const float* face = faces[coordinates.face];
+            const float* t00 = face + (size_t(j0) * resolution + i0) * stride;
+            const float* t10 = face + (size_t(j0) * resolution + i1) * stride;
+            const float* t01 = face + (size_t(j1) * resolution + i0) * stride;
+            const float* t11 = face + (size_t(j1) * resolution + i1) * stride;
+            for (int channel = 0; channel < channels; ++channel)
+            {
+                float bottom = (1.0f - fu) * t00[channel] + fu * t10[channel];
+                float top = (1.0f - fu) * t01[channel] + fu * t11[channel];
+                row[x * channels + channel] = (1.0f - fv) * bottom + fv * top;
+            }
+        }
+    });
+}
@@ -0,0 +1,68 @@
+#ifndef IMAGE_EXPORT_HPP
+#define IMAGE_EXPORT_HPP
+#include <memory>
+#include <string>
+#include <Merlin/Render/cubemap_data.hpp>
+
+using namespace Merlin;
+
+
+enum class ImageFormat
+{
+    Png16,
+    Exr
+};
+
+const char* ImageFormatExtension(ImageFormat format);
+
+
+/*
+Writes an image one row at a time so callers never hold the whole image.
+Rows are interleaved floats, top row first. PNG stores 16 bit unsigned
+values of the clamped [0, 1] range, EXR stores 32 bit floats unchanged.
+Both are written uncompressed.
+*/
+class ImageRowWriter
+{
+public:
+    virtual ~ImageRowWriter() = default;
+
+    virtual bool WriteRow(const float* row) = 0;
+
+    // Returns false if any write failed
+    virtual bool Finish() = 0;
+
+    // Returns nullptr if the file can not be created or channels is not 1 to 4
+    static std::unique_ptr<ImageRowWriter> Create(
+        ImageFormat format,
+        const std::string& path,
+        int width,
+        int height,
+        int channels);
+};
+
+
+/*
+Writes <path_prefix>_<face>.<ext> for each face, faces and row bands run in parallel.
+Both exports write the leading channels of the map and return false when
+it has fewer than channels.
+*/
+bool ExportCubemapFaces(
+    CubemapData& data,
+    int channels,
+    const std::string& path_prefix,
+    ImageFormat format);
+
+/*
+Reprojects to a width x width / 2 longitude/latitude panorama.
+Bands of rows are resampled in parallel with bilinear filtering and then
+streamed to the encoder, so only one band is held in memory.
+*/
+bool ExportEquirectangular(
+    CubemapData& data,
+    int channels,
+    const std::string& path,
+    ImageFormat format,
+    int width);
+
+#endif
@@ -8,9 +8,14 @@
 #include "cube_sphere.hpp"
 #include "noise3d.hpp"
 #include "erosion.hpp"
+#include "biome.hpp"
+#include "profiler.hpp"
 #include "custom_components.hpp"
 #include "editor_window.hpp"
 #include "terrain.hpp"
+#include "terrain_shading.hpp"
+#include "regeneration.hpp"
+#include "scene_frame.hpp"
 
 using namespace Merlin;
 
@@ -22,19 +27,28 @@ class SceneLayer : public Layer
     std::shared_ptr<CubemapData> height_data = nullptr;
     std::shared_ptr<CubemapData> normal_data = nullptr;
     std::shared_ptr<CubemapData> splat_data = nullptr;
+    std::shared_ptr<CubemapData> horizon_data = nullptr;
+    std::shared_ptr<CubemapData> material_data = nullptr;
 
     std::shared_ptr<Cubemap> height_cubemap = nullptr;
     std::shared_ptr<Cubemap> normal_cubemap = nullptr;
     std::shared_ptr<Cubemap> splat_cubemap = nullptr;
+    std::shared_ptr<Cubemap> horizon_cubemap = nullptr;
+    std::shared_ptr<Cubemap> material_cubemap = nullptr;
 
     std::shared_ptr<EditorWindow> editor_window = nullptr;
 
+    std::shared_ptr<TerrainShadingUniforms> shading_uniforms = nullptr;
+    std::shared_ptr<MaterialUniformTarget> uniform_target = nullptr;
+
+    std::shared_ptr<TerrainRegenerator> regenerator = nullptr;
+    std::shared_ptr<SceneFrame> scene_frame = nullptr;
+    PlanetConfig planet_config;
+
     CameraRenderData* camera_data = nullptr;
 
     GameScene scene;
 
-    float time_elapsed = 0.0f;
-
 public:
 
     void LoadResources()
@@ -96,12 +110,17 @@ public:
                 BufferElement{ShaderDataType::Float, "u_terrain_texture_scales[0]" },
                 BufferElement{ShaderDataType::Float, "u_terrain_texture_scales[1]" },
                 BufferElement{ShaderDataType::Float, "u_terrain_texture_scales[2]" },
-                BufferElement{ShaderDataType::Float, "u_terrain_texture_scales[3]" }
+                BufferElement{ShaderDataType::Float, "u_terrain_texture_scales[3]" },
+                BufferElement{ShaderDataType::Float, "u_shadow_softness" },
+                BufferElement{ShaderDataType::Float, "u_ambient_occlusion" },
+                BufferElement{ShaderDataType::Float, "u_two_material_splat" }
             },
             std::vector<std::string>{
             "u_heightmap",
                 "u_normal",
                 "u_splatmap",
+                "u_horizonmap",
+                "u_materialmap",
                 "u_water_normalmap",
                 "u_terrain_textures[0]",
                 "u_terrain_textures[1]",
@@ -118,19 +137,19 @@ public:
 
     void InitializeCubemaps()
     {
-        int resolution = 512;
-
-        height_data = std::make_shared<CubemapData>(resolution, 1);
-        normal_data = std::make_shared<CubemapData>(resolution, 3);
-        splat_data = std::make_shared<CubemapData>(resolution, 4);
+        int resolution = planet_config.resolution;
 
         height_cubemap = Cubemap::Create(resolution, 1);
         normal_cubemap = Cubemap::Create(resolution, 3);
         splat_cubemap = Cubemap::Create(resolution, 4);
+        horizon_cubemap = Cubemap::Create(resolution, 4);
+        material_cubemap = Cubemap::Create(resolution, 3);
 
         terrain_material->SetTexture("u_heightmap", height_cubemap);
         terrain_material->SetTexture("u_normal", normal_cubemap);
         terrain_material->SetTexture("u_splatmap", splat_cubemap);
+        terrain_material->SetTexture("u_horizonmap", horizon_cubemap);
+        terrain_material->SetTexture("u_materialmap", material_cubemap);
     }
 
     void BuildScene()
@@ -177,16 +196,16 @@ public:
         scene.OnAwake();
     }
 
-    void CalculateMaps()
+    // All faces of all maps are swapped in the same frame
+    void UploadMaps(const TerrainMaps& maps)
     {
-        // Procedurally generate map data
-        GenerateNoiseHeightmap(height_data);
-        //ErodeHeightmap(height_data);
-        //SmoothMap(height_data, 1);
-        CalculateNormalMap(height_data, normal_data);
-        GenerateBiomes(splat_data);
-
-        // Upload data to textures
+        TERRAIN_PROFILE_SCOPE("UploadCubemaps");
+        height_data = maps.height_data;
+        normal_data = maps.normal_data;
+        splat_data = maps.splat_data;
+        horizon_data = maps.horizon_data;
+        material_data = maps.material_data;
+
         for (int face_id = CubeFace::Begin; face_id < CubeFace::End; face_id++)
         {
             auto face = static_cast<CubeFace>(face_id);
@@ -194,6 +213,11 @@ public:
             height_cubemap->SetFaceData(face, height_data->GetFaceDataPointer(face));
             normal_cubemap->SetFaceData(face, normal_data->GetFaceDataPointer(face));
             splat_cubemap->SetFaceData(face, splat_data->GetFaceDataPointer(face));
+            horizon_cubemap->SetFaceData(face, horizon_data->GetFaceDataPointer(face));
+            material_cubemap->SetFaceData(face, material_data->GetFaceDataPointer(face));
+            TERRAIN_PROFILE_COUNT(
+                BytesUploaded,
+                uint64_t(height_data->GetResolution()) * height_data->GetResolution() * (1 + 3 + 4 + 4 + 3) * sizeof(float));
         }
     }
 
@@ -202,17 +226,28 @@ public:
         LoadResources();
         InitializeCubemaps();
         BuildScene();
-        CalculateMaps();
-        editor_window = std::make_shared<EditorWindow>(terrain_material);
+        shading_uniforms = std::make_shared<TerrainShadingUniforms>();
+        uniform_target = std::make_shared<MaterialUniformTarget>(terrain_material);
+
+        // The first maps are generated in the background like any later edit
+        regenerator = std::make_shared<TerrainRegenerator>();
+        regenerator->Request(planet_config);
+        scene_frame = std::make_shared<SceneFrame>(shading_uniforms, regenerator);
+        editor_window = std::make_shared<EditorWindow>(shading_uniforms, regenerator, planet_config);
     }
 
     void OnUpdate(float time_step) override
     {
-        time_elapsed += time_step;
-        terrain_material->SetUniformFloat("time", time_elapsed);
+        TERRAIN_PROFILE_SCOPE("Frame");
+
+        if (auto maps = scene_frame->Update(time_step, *uniform_target))
+            UploadMaps(*maps);
 
-        scene.OnUpdate(time_step);
-        scene.RenderScene();
+        {
+            TERRAIN_PROFILE_SCOPE("SceneRender");
+            scene.OnUpdate(time_step);
+            scene.RenderScene();
+        }
 
         {
             Renderer::SetViewport(
@@ -223,6 +258,7 @@ public:
             Renderer::Clear();
         }
         {
+            TERRAIN_PROFILE_SCOPE("EditorDraw");
             auto& io = ImGui::GetIO();
             io.DisplaySize = ImVec2(
                 (float)Application::Get().GeMaintWindow()->GetWidth(),
@@ -0,0 +1,177 @@
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include "memory_arena.hpp"
+#include "parallel.hpp"
+#include "profiler.hpp"
+
+
+static const std::align_val_t buffer_alignment{ 64 };
+
+static uint64_t CubemapBytes(int resolution, int channels)
+{
+    return 6 * uint64_t(resolution) * resolution * channels * sizeof(float);
+}
+
+size_t ScratchBufferSize(size_t float_count)
+{
+    size_t size_class = 1024;
+    while (size_class < float_count)
+        size_class *= 2;
+    return size_class;
+}
+
+static void ReserveBytes(ArenaStatistics& statistics, uint64_t bytes, bool reused)
+{
+    if (reused)
+    {
+        statistics.reuses++;
+    }
+    else
+    {
+        statistics.allocations++;
+        statistics.bytes_reserved += bytes;
+        statistics.high_water_bytes = std::max(statistics.high_water_bytes, statistics.bytes_reserved);
+    }
+    statistics.bytes_in_use += bytes;
+}
+
+
+TerrainArena::State::~State()
+{
+    for (auto& entry : free_buffers)
+        for (float* buffer : entry.second)
+            ::operator delete(buffer, buffer_alignment);
+}
+
+TerrainArena::TerrainArena() :
+    m_state(std::make_shared<State>())
+{
+}
+
+std::shared_ptr<CubemapData> TerrainArena::AcquireCubemap(int resolution, int channels)
+{
+    auto key = std::make_pair(resolution, channels);
+    uint64_t bytes = CubemapBytes(resolution, channels);
+    std::unique_ptr<CubemapData> cubemap = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(m_state->mutex);
+        auto& free_list = m_state->free_cubemaps[key];
+        if (!free_list.empty())
+        {
+            cubemap = std::move(free_list.back());
+            free_list.pop_back();
+        }
+        ReserveBytes(m_state->statistics, bytes, cubemap != nullptr);
+    }
+    if (cubemap == nullptr)
+    {
+        TERRAIN_PROFILE_SCOPE("TerrainArena/AllocateCubemap");
+        cubemap = std::make_unique<CubemapData>(resolution, channels);
+    }
+
+    // The state outlives the arena while handles are held
+    auto state = m_state;
+    return std::shared_ptr<CubemapData>(cubemap.release(), [state, key, bytes](CubemapData* released) {
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->statistics.bytes_in_use -= bytes;
+            auto& retained = state->retained_resolutions;
+            if (retained.empty() || std::find(retained.begin(), retained.end(), key.first) != retained.end())
+            {
+                state->free_cubemaps[key].emplace_back(released);
+                return;
+            }
+            state->statistics.bytes_reserved -= bytes;
+        }
+        delete released;
+    });
+}
+
+ScratchBuffer TerrainArena::AcquireBuffer(size_t float_count)
+{
+    size_t size_class = ScratchBufferSize(float_count);
+    uint64_t bytes = size_class * sizeof(float);
+    float* buffer = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(m_state->mutex);
+        auto& free_list = m_state->free_buffers[size_class];
+        if (!free_list.empty())
+        {
+            buffer = free_list.back();
+            free_list.pop_back();
+        }
+        ReserveBytes(m_state->statistics, bytes, buffer != nullptr);
+    }
+    if (buffer == nullptr)
+    {
+        TERRAIN_PROFILE_SCOPE("TerrainArena/AllocateBuffer");
+        buffer = static_cast<float*>(::operator new(bytes, buffer_alignment));
+
+        // First touch from the pool, one page run per task
+        const size_t chunk_bytes = size_t(1) << 20;
+        int chunk_count = static_cast<int>((bytes + chunk_bytes - 1) / chunk_bytes);
+        char* bytes_pointer = reinterpret_cast<char*>(buffer);
+        ParallelFor(chunk_count, [bytes_pointer, bytes, chunk_bytes](int chunk) {
+            size_t start = chunk * chunk_bytes;
+            std::memset(bytes_pointer + start, 0, std::min<size_t>(chunk_bytes, bytes - start));
+        });
+    }
+
+    auto state = m_state;
+    ScratchBuffer scratch;
+    scratch.size = size_class;
+    scratch.memory = std::shared_ptr<float>(buffer, [state, size_class, bytes](float* released) {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->free_buffers[size_class].push_back(released);
+        state->statistics.bytes_in_use -= bytes;
+    });
+    return scratch;
+}
+
+ArenaStatistics TerrainArena::GetStatistics()
+{
+    std::lock_guard<std::mutex> lock(m_state->mutex);
+    return m_state->statistics;
+}
+
+void TerrainArena::Trim()
+{
+    std::lock_guard<std::mutex> lock(m_state->mutex);
+    TrimLocked(*m_state);
+}
+
+void TerrainArena::RetainResolutions(std::vector<int> resolutions)
+{
+    std::sort(resolutions.begin(), resolutions.end());
+    resolutions.erase(std::unique(resolutions.begin(), resolutions.end()), resolutions.end());
+    std::lock_guard<std::mutex> lock(m_state->mutex);
+    if (m_state->retained_resolutions == resolutions)
+        return;
+    m_state->retained_resolutions = std::move(resolutions);
+    TrimLocked(*m_state);
+}
+
+void TerrainArena::TrimLocked(State& state)
+{
+    for (auto& entry : state.free_cubemaps)
+    {
+        uint64_t bytes = CubemapBytes(entry.first.first, entry.first.second);
+        state.statistics.bytes_reserved -= bytes * entry.second.size();
+        entry.second.clear();
+    }
+    for (auto& entry : state.free_buffers)
+    {
+        for (float* buffer : entry.second)
+            ::operator delete(buffer, buffer_alignment);
+        state.statistics.bytes_reserved -= entry.first * sizeof(float) * entry.second.size();
+        entry.second.clear();
+    }
+}
+
+
+TerrainArena& SharedTerrainArena()
+{
+    static TerrainArena arena;
+    return arena;
+}
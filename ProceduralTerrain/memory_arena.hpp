@@ -0,0 +1,87 @@
+#ifndef MEMORY_ARENA_HPP
+#define MEMORY_ARENA_HPP
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include <Merlin/Render/cubemap_data.hpp>
+
+using namespace Merlin;
+
+
+struct ArenaStatistics
+{
+    uint64_t bytes_reserved = 0;
+    uint64_t bytes_in_use = 0;
+    uint64_t high_water_bytes = 0;
+    uint64_t allocations = 0;
+    uint64_t reuses = 0;
+};
+
+// 64 byte aligned floats, at least the requested size
+struct ScratchBuffer
+{
+    std::shared_ptr<float> memory = nullptr;
+    size_t size = 0;
+
+    inline float* data() const { return memory.get(); }
+};
+
+
+/*
+Recycles pipeline memory between stages and regenerations.
+Cubemaps are pooled by resolution and channel count, scratch buffers by
+power of two size class. Released memory returns to the pool when the last
+handle is dropped, so reused memory holds stale values and callers must
+overwrite it. New scratch buffers are zeroed in parallel so their pages
+are faulted in by the worker threads that later use them. Cubemaps are
+only pooled, CubemapData owns its face storage, so their alignment and
+first touch are left to Merlin.
+Pooled memory is only returned by Trim or RetainResolutions, so long lived
+callers must use one of them when their working set shrinks.
+*/
+class TerrainArena
+{
+    struct State
+    {
+        std::mutex mutex;
+        std::map<std::pair<int, int>, std::vector<std::unique_ptr<CubemapData>>> free_cubemaps;
+        std::map<size_t, std::vector<float*>> free_buffers;
+        ArenaStatistics statistics;
+        // Empty pools every resolution
+        std::vector<int> retained_resolutions;
+
+        ~State();
+    };
+    std::shared_ptr<State> m_state;
+
+    static void TrimLocked(State& state);
+
+public:
+    TerrainArena();
+
+    std::shared_ptr<CubemapData> AcquireCubemap(int resolution, int channels);
+
+    ScratchBuffer AcquireBuffer(size_t float_count);
+
+    ArenaStatistics GetStatistics();
+
+    // Frees pooled memory that is not in use
+    void Trim();
+
+    /*
+    Trims the pool and from then on only pools cubemaps of these resolutions,
+    others are freed when their last handle is dropped. An empty list pools
+    all again. Nothing is trimmed if the list is unchanged.
+    */
+    void RetainResolutions(std::vector<int> resolutions);
+};
+
+TerrainArena& SharedTerrainArena();
+
+// Floats AcquireBuffer reserves for a request of float_count
+size_t ScratchBufferSize(size_t float_count);
+
+#endif
@@ -1,38 +1,164 @@
 #include "noise3d.hpp"
 
 
-float FractalNoise(
+static uint32_t HashSeed(uint32_t value)
+{
+    value ^= value >> 16;
+    value *= 0x7feb352dU;
+    value ^= value >> 15;
+    value *= 0x846ca68bU;
+    value ^= value >> 16;
+    return value;
+}
+
+glm::vec3 NoiseSeedOffset(uint32_t seed)
+{
+    if (seed == 0)
+        return glm::vec3(0.0f);
+
+    // Offsets stay small so float precision is kept at high octave frequencies
+    uint32_t hx = HashSeed(seed);
+    uint32_t hy = HashSeed(hx);
+    uint32_t hz = HashSeed(hy);
+    return 200.0f * (glm::vec3(
+        hx / 4294967296.0f,
+        hy / 4294967296.0f,
+        hz / 4294967296.0f) - 0.5f);
+}
+
+static glm::vec3 Mod289(glm::vec3 x)
+{
+    return x - glm::floor(x * (1.0f / 289.0f)) * 289.0f;
+}
+
+static glm::vec4 Mod289(glm::vec4 x)
+{
+    return x - glm::floor(x * (1.0f / 289.0f)) * 289.0f;
+}
+
+static glm::vec4 Permute(glm::vec4 x)
+{
+    return Mod289(((x * 34.0f) + 1.0f) * x);
+}
+
+static glm::vec4 TaylorInvSqrt(glm::vec4 r)
+{
+    return 1.79284291400159f - 0.85373472095314f * r;
+}
+
+NoiseSample SmoothNoiseGradient(glm::vec3 point)
+{
+    const glm::vec2 C(1.0f / 6.0f, 1.0f / 3.0f);
+    const glm::vec4 D(0.0f, 0.5f, 1.0f, 2.0f);
+
+    // First corner
+    glm::vec3 i = glm::floor(point + glm::dot(point, glm::vec3(C.y)));
+    glm::vec3 x0 = point - i + glm::dot(i, glm::vec3(C.x));
+
+    // Other corners
+    glm::vec3 g = glm::step(glm::vec3(x0.y, x0.z, x0.x), x0);
+    glm::vec3 l = 1.0f - g;
+    glm::vec3 i1 = glm::min(g, glm::vec3(l.z, l.x, l.y));
+    glm::vec3 i2 = glm::max(g, glm::vec3(l.z, l.x, l.y));
+
+    glm::vec3 x1 = x0 - i1 + C.x;
+    glm::vec3 x2 = x0 - i2 + C.y;
+    glm::vec3 x3 = x0 - D.y;
+
+    // Permutations
+    i = Mod289(i);
+    glm::vec4 p = Permute(Permute(Permute(
+        i.z + glm::vec4(0.0f, i1.z, i2.z, 1.0f)) +
+        i.y + glm::vec4(0.0f, i1.y, i2.y, 1.0f)) +
+        i.x + glm::vec4(0.0f, i1.x, i2.x, 1.0f));
+
+    // Gradients on a 7x7 grid mapped onto an octahedron
+    float n_ = 0.142857142857f;
+    glm::vec3 ns = n_ * glm::vec3(D.w, D.y, D.z) - glm::vec3(D.x, D.z, D.x);
+
+    glm::vec4 j = p - 49.0f * glm::floor(p * ns.z * ns.z);
+    glm::vec4 x_ = glm::floor(j * ns.z);
+    glm::vec4 y_ = glm::floor(j - 7.0f * x_);
+
+    glm::vec4 x = x_ * ns.x + ns.y;
+    glm::vec4 y = y_ * ns.x + ns.y;
+    glm::vec4 h = 1.0f - glm::abs(x) - glm::abs(y);
+
+    glm::vec4 b0(x.x, x.y, y.x, y.y);
+    glm::vec4 b1(x.z, x.w, y.z, y.w);
+    glm::vec4 s0 = glm::floor(b0) * 2.0f + 1.0f;
+    glm::vec4 s1 = glm::floor(b1) * 2.0f + 1.0f;
+    glm::vec4 sh = -glm::step(h, glm::vec4(0.0f));
+
+    glm::vec4 a0 = glm::vec4(b0.x, b0.z, b0.y, b0.w) + glm::vec4(s0.x, s0.z, s0.y, s0.w) * glm::vec4(sh.x, sh.x, sh.y, sh.y);
+    glm::vec4 a1 = glm::vec4(b1.x, b1.z, b1.y, b1.w) + glm::vec4(s1.x, s1.z, s1.y, s1.w) * glm::vec4(sh.z, sh.z, sh.w, sh.w);
+
+    glm::vec3 p0(a0.x, a0.y, h.x);
+    glm::vec3 p1(a0.z, a0.w, h.y);
+    glm::vec3 p2(a1.x, a1.y, h.z);
+    glm::vec3 p3(a1.z, a1.w, h.w);
+
+    // Normalise gradients
+    glm::vec4 norm = TaylorInvSqrt(glm::vec4(
+        glm::dot(p0, p0), glm::dot(p1, p1), glm::dot(p2, p2), glm::dot(p3, p3)));
+    p0 *= norm.x;
+    p1 *= norm.y;
+    p2 *= norm.z;
+    p3 *= norm.w;
+
+    // Mix final noise value, n = 42 * sum(m^4 * (g.x)) with m = max(0.6 - |x|^2, 0)
+    glm::vec4 m = glm::max(
+        0.6f - glm::vec4(glm::dot(x0, x0), glm::dot(x1, x1), glm::dot(x2, x2), glm::dot(x3, x3)),
+        glm::vec4(0.0f));
+    glm::vec4 m2 = m * m;
+    glm::vec4 m4 = m2 * m2;
+    glm::vec4 px(glm::dot(p0, x0), glm::dot(p1, x1), glm::dot(p2, x2), glm::dot(p3, x3));
+
+    // dn/dx = 42 * sum(m^4 * g - 8 * m^3 * (g.x) * x)
+    glm::vec4 m3px = m2 * m * px;
+    glm::vec3 gradient = (
+        m4.x * p0 + m4.y * p1 + m4.z * p2 + m4.w * p3 -
+        8.0f * (m3px.x * x0 + m3px.y * x1 + m3px.z * x2 + m3px.w * x3));
+
+    return NoiseSample{ 42.0f * glm::dot(m4, px), 42.0f * gradient };
+}
+
+NoiseSample FractalNoiseGradient(
     glm::vec3 point,
     float base_frequency,
     int octaves,
     float persistence,
     float frequency_multiplier)
 {
-    float result = 0.0f;
+    NoiseSample result{ 0.0f, glm::vec3(0.0f) };
     float amplitude = 1.0f;
     float frequency = base_frequency;
     for (int i = 0; i < octaves; ++i)
     {
-        result += amplitude * SmoothNoise(frequency * point);
+        auto sample = SmoothNoiseGradient(frequency * point);
+        result.value += amplitude * sample.value;
+        result.gradient += (amplitude * frequency) * sample.gradient;
         amplitude *= persistence;
         frequency *= frequency_multiplier;
     }
     return result;
 }
 
-float FractalRidgeNoise(
+NoiseSample FractalRidgeNoiseGradient(
     glm::vec3 point,
     float base_frequency,
     int octaves,
     float persistence,
     float frequency_multiplier)
 {
-    float result = 0.0f;
+    NoiseSample result{ 0.0f, glm::vec3(0.0f) };
     float amplitude = 1.0f;
     float frequency = base_frequency;
     for (int i = 0; i < octaves; ++i)
     {
-        result += amplitude * SmoothRidgeNoise(frequency * point);
+        auto sample = SmoothRidgeNoiseGradient(frequency * point);
+        result.value += amplitude * sample.value;
+        result.gradient += (amplitude * frequency) * sample.gradient;
         amplitude *= persistence;
         frequency *= frequency_multiplier;
     }
@@ -2,6 +2,7 @@
 #define NOISE3D_HPP
 #include "Merlin/Render//cubemap_data.hpp"
 #include "glm/gtc/noise.hpp"
+#include <cstdint>
 
 using namespace Merlin;
 
@@ -16,14 +17,257 @@ inline float SmoothRidgeNoise(glm::vec3 point)
     return 1.0f - 2.0f * glm::abs(glm::simplex(point));
 }
 
-float FractalNoise(
+struct NoiseSample
+{
+    float value;
+    glm::vec3 gradient;
+};
+
+/*
+Simplex noise together with its exact gradient.
+Follows the same lattice, hashing and kernel as glm::simplex so the value
+matches SmoothNoise.
+*/
+NoiseSample SmoothNoiseGradient(glm::vec3 point);
+
+inline NoiseSample SmoothRidgeNoiseGradient(glm::vec3 point)
+{
+    auto sample = SmoothNoiseGradient(point);
+    float sign = sample.value < 0.0f ? -1.0f : 1.0f;
+    return NoiseSample{
+        1.0f - 2.0f * glm::abs(sample.value),
+        -2.0f * sign * sample.gradient };
+}
+
+// Noise domain offset standing in for a seed, seed 0 leaves the domain unchanged
+glm::vec3 NoiseSeedOffset(uint32_t seed);
+
+//////////////////////////////
+// NOISE BASES
+//////////////////////////////
+/*
+Bases for the fractal functions, chosen by template parameter so the basis
+inlines into the octave loop. Each returns roughly [-1, 1].
+SimplexBasis is glm::simplex and ignores the seed, seed it through
+NoiseSeedOffset instead. The hash bases take the seed into the lattice hash
+and are much cheaper per sample.
+*/
+inline uint32_t HashLattice(int x, int y, int z, uint32_t seed)
+{
+    uint32_t hash = seed;
+    hash ^= static_cast<uint32_t>(x) * 0x8DA6B343U;
+    hash ^= static_cast<uint32_t>(y) * 0xD8163841U;
+    hash ^= static_cast<uint32_t>(z) * 0xCB1AB31FU;
+    hash ^= hash >> 15;
+    hash *= 0x2C1B3C6DU;
+    hash ^= hash >> 12;
+    return hash;
+}
+
+// Dot product with one of the 12 cube edge directions
+inline float LatticeGradientDot(uint32_t hash, float x, float y, float z)
+{
+    static const float gradients[12][3] = {
+        { 1, 1, 0 }, { -1, 1, 0 }, { 1, -1, 0 }, { -1, -1, 0 },
+        { 1, 0, 1 }, { -1, 0, 1 }, { 1, 0, -1 }, { -1, 0, -1 },
+        { 0, 1, 1 }, { 0, -1, 1 }, { 0, 1, -1 }, { 0, -1, -1 } };
+    const float* g = gradients[((hash >> 16) * 12) >> 16];
+    return g[0] * x + g[1] * y + g[2] * z;
+}
+
+inline int FastFloor(float x)
+{
+    int i = static_cast<int>(x);
+    return x < i ? i - 1 : i;
+}
+
+inline float QuinticFade(float t)
+{
+    return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+}
+
+struct SimplexBasis
+{
+    static inline float Evaluate(glm::vec3 point, uint32_t)
+    {
+        return glm::simplex(point);
+    }
+};
+
+// Perlin style gradient noise on an integer hashed lattice
+struct GradientBasis
+{
+    static inline float Evaluate(glm::vec3 point, uint32_t seed)
+    {
+        int x = FastFloor(point.x);
+        int y = FastFloor(point.y);
+        int z = FastFloor(point.z);
+        glm::vec3 f = point - glm::vec3(x, y, z);
+
+        auto corner = [&](int dx, int dy, int dz) {
+            return LatticeGradientDot(
+                HashLattice(x + dx, y + dy, z + dz, seed),
+                f.x - dx, f.y - dy, f.z - dz);
+        };
+
+        float u = QuinticFade(f.x);
+        float v = QuinticFade(f.y);
+        float w = QuinticFade(f.z);
+        float x00 = glm::mix(corner(0, 0, 0), corner(1, 0, 0), u);
+        float x10 = glm::mix(corner(0, 1, 0), corner(1, 1, 0), u);
+        float x01 = glm::mix(corner(0, 0, 1), corner(1, 0, 1), u);
+        float x11 = glm::mix(corner(0, 1, 1), corner(1, 1, 1), u);
+        return glm::mix(glm::mix(x00, x10, v), glm::mix(x01, x11, v), w);
+    }
+};
+
+// Hashed lattice values blended with the quintic fade
+struct ValueBasis
+{
+    static inline float Evaluate(glm::vec3 point, uint32_t seed)
+    {
+        int x = FastFloor(point.x);
+        int y = FastFloor(point.y);
+        int z = FastFloor(point.z);
+        glm::vec3 f = point - glm::vec3(x, y, z);
+
+        auto corner = [&](int dx, int dy, int dz) {
+            return HashLattice(x + dx, y + dy, z + dz, seed) * (2.0f / 4294967296.0f) - 1.0f;
+        };
+
+        float u = QuinticFade(f.x);
+        float v = QuinticFade(f.y);
+        float w = QuinticFade(f.z);
+        float x00 = glm::mix(corner(0, 0, 0), corner(1, 0, 0), u);
+        float x10 = glm::mix(corner(0, 1, 0), corner(1, 1, 0), u);
+        float x01 = glm::mix(corner(0, 0, 1), corner(1, 0, 1), u);
+        float x11 = glm::mix(corner(0, 1, 1), corner(1, 1, 1), u);
+        return glm::mix(glm::mix(x00, x10, v), glm::mix(x01, x11, v), w);
+    }
+};
+
+/*
+OpenSimplex2 style noise on the body centred cubic lattice.
+The rotated point is split over two offset cubic lattices, and each
+contributes its nearest vertex and the next closest vertex along the
+dominant axis with a (0.6 - d^2)^4 falloff.
+*/
+struct OpenSimplex2Basis
+{
+    static inline float Evaluate(glm::vec3 point, uint32_t seed)
+    {
+        float r = (2.0f / 3.0f) * (point.x + point.y + point.z);
+        glm::vec3 rotated = glm::vec3(r) - point;
+
+        int x = FastFloor(rotated.x + 0.5f);
+        int y = FastFloor(rotated.y + 0.5f);
+        int z = FastFloor(rotated.z + 0.5f);
+        glm::vec3 d = rotated - glm::vec3(x, y, z);
+        int sx = d.x > 0.0f ? -1 : 1;
+        int sy = d.y > 0.0f ? -1 : 1;
+        int sz = d.z > 0.0f ? -1 : 1;
+        glm::vec3 a0 = glm::abs(d);
+
+        float value = 0.0f;
+        float a = 0.6f - glm::dot(d, d);
+        for (int lattice = 0; ; ++lattice)
+        {
+            if (a > 0.0f)
+                value += (a * a) * (a * a) * LatticeGradientDot(HashLattice(x, y, z, seed), d.x, d.y, d.z);
+
+            if (a0.x >= a0.y && a0.x >= a0.z)
+            {
+                float b = a + 2.0f * a0.x - 1.0f;
+                if (b > 0.0f)
+                    value += (b * b) * (b * b) * LatticeGradientDot(HashLattice(x - sx, y, z, seed), d.x + sx, d.y, d.z);
+            }
+            else if (a0.y > a0.x && a0.y >= a0.z)
+            {
+                float b = a + 2.0f * a0.y - 1.0f;
+                if (b > 0.0f)
+                    value += (b * b) * (b * b) * LatticeGradientDot(HashLattice(x, y - sy, z, seed), d.x, d.y + sy, d.z);
+            }
+            else
+            {
+                float b = a + 2.0f * a0.z - 1.0f;
+                if (b > 0.0f)
+                    value += (b * b) * (b * b) * LatticeGradientDot(HashLattice(x, y, z - sz, seed), d.x, d.y, d.z + sz);
+            }
+
+            if (lattice == 1)
+                break;
+
+            // Move to the second lattice, offset by half a cell towards the point
+            a0 = glm::vec3(0.5f) - a0;
+            d = glm::vec3(sx * a0.x, sy * a0.y, sz * a0.z);
+            a += (0.75f - a0.x) - (a0.y + a0.z);
+            x += (sx >> 1) & 1;
+            y += (sy >> 1) & 1;
+            z += (sz >> 1) & 1;
+            sx = -sx;
+            sy = -sy;
+            sz = -sz;
+            seed ^= 0x9E3779B9U;
+        }
+        return 32.0f * value;
+    }
+};
+
+
+//////////////////////////////
+// FRACTALS
+//////////////////////////////
+// Octaves use consecutive seeds so hash bases do not repeat between octaves
+template<typename Basis = SimplexBasis>
+inline float FractalNoise(
+    glm::vec3 point,
+    float base_frequency,
+    int octaves,
+    float persistence,
+    float frequency_multiplier,
+    uint32_t seed = 0)
+{
+    float result = 0.0f;
+    float amplitude = 1.0f;
+    float frequency = base_frequency;
+    for (int i = 0; i < octaves; ++i)
+    {
+        result += amplitude * Basis::Evaluate(frequency * point, seed + i);
+        amplitude *= persistence;
+        frequency *= frequency_multiplier;
+    }
+    return result;
+}
+
+template<typename Basis = SimplexBasis>
+inline float FractalRidgeNoise(
+    glm::vec3 point,
+    float base_frequency,
+    int octaves,
+    float persistence,
+    float frequency_multiplier,
+    uint32_t seed = 0)
+{
+    float result = 0.0f;
+    float amplitude = 1.0f;
+    float frequency = base_frequency;
+    for (int i = 0; i < octaves; ++i)
+    {
+        result += amplitude * (1.0f - 2.0f * glm::abs(Basis::Evaluate(frequency * point, seed + i)));
+        amplitude *= persistence;
+        frequency *= frequency_multiplier;
+    }
+    return result;
+}
+
+NoiseSample FractalNoiseGradient(
     glm::vec3 point,
     float base_frequency,
     int octaves,
     float persistence,
     float frequency_multiplier);
 
-float FractalRidgeNoise(
+NoiseSample FractalRidgeNoiseGradient(
     glm::vec3 point,
     float base_frequency,
     int octaves,
@@ -0,0 +1,73 @@
+#include <chrono>
+#include "parallel.hpp"
+
+
+static std::atomic<int> worker_thread_count{ 0 };
+
+
+ThreadPool::ThreadPool(int thread_count)
+{
+    for (int i = 0; i < std::max(thread_count, 1); ++i)
+        m_threads.emplace_back([this]() { WorkerLoop(); });
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_condition.notify_all();
+    for (auto& thread : m_threads)
+        thread.join();
+}
+
+void ThreadPool::Submit(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_tasks.push_back(std::move(task));
+    }
+    m_condition.notify_one();
+}
+
+void ThreadPool::WorkerLoop()
+{
+    while (true)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, [this]() { return m_stopping || !m_tasks.empty(); });
+            if (m_tasks.empty())
+                return;
+            task = std::move(m_tasks.front());
+            m_tasks.pop_front();
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        task();
+        auto stop = std::chrono::steady_clock::now();
+        m_busy_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count();
+    }
+}
+
+ThreadPool& SharedThreadPool()
+{
+    static ThreadPool pool(static_cast<int>(std::thread::hardware_concurrency()));
+    return pool;
+}
+
+
+void SetWorkerThreadCount(int thread_count)
+{
+    worker_thread_count = std::max(thread_count, 0);
+}
+
+int GetWorkerThreadCount()
+{
+    int count = worker_thread_count;
+    if (count > 0)
+        return count;
+    return std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+}
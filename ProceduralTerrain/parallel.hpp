@@ -0,0 +1,99 @@
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+/*
+Fixed set of worker threads consuming a shared task queue.
+*/
+class ThreadPool
+{
+    std::vector<std::thread> m_threads;
+    std::deque<std::function<void()>> m_tasks;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    bool m_stopping = false;
+    std::atomic<int64_t> m_busy_ns{ 0 };
+
+public:
+    explicit ThreadPool(int thread_count);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void Submit(std::function<void()> task);
+
+    inline int GetThreadCount() const { return static_cast<int>(m_threads.size()); }
+
+    // Total time workers have spent inside tasks
+    inline double GetBusySeconds() const { return 1.0e-9 * m_busy_ns.load(); }
+
+private:
+    void WorkerLoop();
+};
+
+// Pool shared by every terrain pass, sized to the hardware concurrency
+ThreadPool& SharedThreadPool();
+
+
+/*
+Upper bound on the number of threads used by the terrain passes.
+A count of zero uses the hardware concurrency.
+*/
+void SetWorkerThreadCount(int thread_count);
+
+int GetWorkerThreadCount();
+
+
+/*
+Runs work(task) for every task in [0, task_count) on the shared pool.
+The calling thread takes tasks too, so nested calls from pool workers
+always make progress even when every worker is busy.
+*/
+template<typename Work>
+void ParallelFor(int task_count, const Work& work)
+{
+    struct State
+    {
+        std::atomic<int> next_task{ 0 };
+        std::atomic<int> completed{ 0 };
+        std::mutex mutex;
+        std::condition_variable finished;
+    };
+    auto state = std::make_shared<State>();
+    const Work* work_pointer = &work;
+
+    // Helpers that start after all tasks are claimed return without touching work
+    auto worker = [state, work_pointer, task_count]() {
+        for (int task = state->next_task++; task < task_count; task = state->next_task++)
+        {
+            (*work_pointer)(task);
+            if (++state->completed == task_count)
+            {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                state->finished.notify_all();
+            }
+        }
+    };
+
+    int helper_count = std::min(task_count, GetWorkerThreadCount()) - 1;
+    for (int i = 0; i < helper_count; ++i)
+        SharedThreadPool().Submit(worker);
+    worker();
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->finished.wait(lock, [&state, task_count]() {
+        return state->completed == task_count;
+    });
+}
+
+#endif
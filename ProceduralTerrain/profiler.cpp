@@ -0,0 +1,285 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <unordered_map>
+#include "profiler.hpp"
+
+
+using ProfileCounters = std::array<uint64_t, static_cast<size_t>(ProfileCounter::Count)>;
+
+struct ZoneTotals
+{
+    uint64_t calls = 0;
+    int64_t total_ns = 0;
+    int64_t max_ns = 0;
+
+    void Add(int64_t duration_ns)
+    {
+        calls += 1;
+        total_ns += duration_ns;
+        max_ns = std::max(max_ns, duration_ns);
+    }
+
+    void Merge(const ZoneTotals& other)
+    {
+        calls += other.calls;
+        total_ns += other.total_ns;
+        max_ns = std::max(max_ns, other.max_ns);
+    }
+};
+
+// Latest trace_zone_capacity zones, the oldest are overwritten
+struct ZoneRing
+{
+    std::vector<ProfileZone> zones;
+    size_t next = 0;
+
+    void Push(const ProfileZone& zone)
+    {
+        if (zones.size() < Profiler::trace_zone_capacity)
+            zones.push_back(zone);
+        else
+            zones[next] = zone;
+        next = (next + 1) % Profiler::trace_zone_capacity;
+    }
+
+    // Oldest first
+    void AppendTo(std::vector<ProfileZone>& output) const
+    {
+        output.insert(output.end(), zones.begin() + next, zones.end());
+        output.insert(output.end(), zones.begin(), zones.begin() + next);
+    }
+
+    void Clear()
+    {
+        zones.clear();
+        next = 0;
+    }
+};
+
+struct ThreadProfile
+{
+    uint32_t thread_id;
+    // Open zones, only touched by the owning thread
+    int depth = 0;
+    std::mutex mutex;
+    std::unordered_map<const char*, ZoneTotals> totals;
+    ZoneRing trace;
+    int64_t busy_ns = 0;
+    std::array<std::atomic<uint64_t>, static_cast<size_t>(ProfileCounter::Count)> counters{};
+
+    ThreadProfile();
+    ~ThreadProfile();
+
+    ProfileCounters LoadCounters() const
+    {
+        ProfileCounters values{};
+        for (size_t k = 0; k < values.size(); ++k)
+            values[k] = counters[k].load(std::memory_order_relaxed);
+        return values;
+    }
+
+    // Caller must hold the thread's mutex
+    ProfileThreadSummary SummarizeLocked() const
+    {
+        ProfileThreadSummary summary;
+        summary.thread_id = thread_id;
+        summary.busy_ms = 1.0e-6 * busy_ns;
+        summary.counters = LoadCounters();
+        return summary;
+    }
+};
+
+static std::mutex registry_mutex;
+static std::vector<ThreadProfile*> live_threads;
+static std::map<std::string, ZoneTotals> retired_totals;
+static ZoneRing retired_trace;
+static std::vector<ProfileThreadSummary> retired_threads;
+static std::atomic<uint32_t> next_thread_id{ 0 };
+static const auto profiler_epoch = std::chrono::steady_clock::now();
+
+
+ThreadProfile::ThreadProfile() :
+    thread_id(next_thread_id++)
+{
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    live_threads.push_back(this);
+}
+
+ThreadProfile::~ThreadProfile()
+{
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    live_threads.erase(std::find(live_threads.begin(), live_threads.end(), this));
+    for (const auto& entry : totals)
+        retired_totals[entry.first].Merge(entry.second);
+    for (const auto& zone : trace.zones)
+        retired_trace.Push(zone);
+    retired_threads.push_back(SummarizeLocked());
+}
+
+static ThreadProfile& LocalProfile()
+{
+    thread_local ThreadProfile profile;
+    return profile;
+}
+
+// Gathers everything recorded so far, the trace is only copied when zones is set
+static void Collect(
+    std::map<std::string, ZoneTotals>& totals,
+    std::vector<ProfileThreadSummary>& threads,
+    std::vector<ProfileZone>* zones)
+{
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    totals = retired_totals;
+    threads = retired_threads;
+    if (zones != nullptr)
+        retired_trace.AppendTo(*zones);
+    for (auto* thread : live_threads)
+    {
+        std::lock_guard<std::mutex> thread_lock(thread->mutex);
+        for (const auto& entry : thread->totals)
+            totals[entry.first].Merge(entry.second);
+        threads.push_back(thread->SummarizeLocked());
+        if (zones != nullptr)
+            thread->trace.AppendTo(*zones);
+    }
+}
+
+
+const char* ProfileCounterName(ProfileCounter counter)
+{
+    switch (counter)
+    {
+    case ProfileCounter::TexelsProcessed: return "TexelsProcessed";
+    case ProfileCounter::ParticlesUpdated: return "ParticlesUpdated";
+    case ProfileCounter::ParticleResets: return "ParticleResets";
+    case ProfileCounter::Deposits: return "Deposits";
+    case ProfileCounter::BytesUploaded: return "BytesUploaded";
+    default: return "Unknown";
+    }
+}
+
+int64_t Profiler::Now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - profiler_epoch).count();
+}
+
+int64_t Profiler::BeginZone()
+{
+    LocalProfile().depth++;
+    return Now();
+}
+
+void Profiler::RecordZone(const char* name, int argument, int64_t start_ns, int64_t end_ns)
+{
+    auto& profile = LocalProfile();
+    int64_t duration_ns = end_ns - start_ns;
+    std::lock_guard<std::mutex> lock(profile.mutex);
+    profile.totals[name].Add(duration_ns);
+    profile.trace.Push(ProfileZone{ name, argument, profile.thread_id, start_ns, end_ns });
+
+    // Only outermost zones count as busy time, so nested zones are not counted twice
+    profile.depth = std::max(profile.depth - 1, 0);
+    if (profile.depth == 0)
+        profile.busy_ns += duration_ns;
+}
+
+void Profiler::AddCount(ProfileCounter counter, uint64_t amount)
+{
+    // Atomic add so a concurrent Reset is never overwritten
+    LocalProfile().counters[static_cast<size_t>(counter)].fetch_add(amount, std::memory_order_relaxed);
+}
+
+ProfileSummary Profiler::GetSummary()
+{
+    std::map<std::string, ZoneTotals> totals;
+    std::vector<ProfileThreadSummary> threads;
+    Collect(totals, threads, nullptr);
+
+    ProfileSummary summary;
+    for (const auto& entry : totals)
+    {
+        ProfileZoneSummary zone_summary;
+        zone_summary.name = entry.first;
+        zone_summary.calls = entry.second.calls;
+        zone_summary.total_ms = 1.0e-6 * entry.second.total_ns;
+        zone_summary.max_ms = 1.0e-6 * entry.second.max_ns;
+        summary.zones.push_back(zone_summary);
+    }
+
+    std::sort(threads.begin(), threads.end(), [](const ProfileThreadSummary& a, const ProfileThreadSummary& b) {
+        return a.thread_id < b.thread_id;
+    });
+    for (const auto& thread : threads)
+    {
+        for (size_t k = 0; k < summary.counters.size(); ++k)
+            summary.counters[k] += thread.counters[k];
+    }
+    summary.threads = std::move(threads);
+    return summary;
+}
+
+bool Profiler::WriteChromeTrace(const std::string& path)
+{
+    std::map<std::string, ZoneTotals> totals;
+    std::vector<ProfileThreadSummary> threads;
+    std::vector<ProfileZone> zones;
+    Collect(totals, threads, &zones);
+
+    std::ofstream file(path);
+    if (!file)
+        return false;
+
+    // Microseconds with nanosecond digits, the default precision loses them a second into a session
+    file << std::fixed << std::setprecision(3);
+    int64_t last_ns = 0;
+    file << "{\"traceEvents\":[\n";
+    for (const auto& zone : zones)
+    {
+        file << "{\"name\":\"" << zone.name << "\",\"ph\":\"X\",\"pid\":1"
+            << ",\"tid\":" << zone.thread_id
+            << ",\"ts\":" << 1.0e-3 * zone.start_ns
+            << ",\"dur\":" << 1.0e-3 * (zone.end_ns - zone.start_ns);
+        if (zone.argument >= 0)
+            file << ",\"args\":{\"index\":" << zone.argument << "}";
+        file << "},\n";
+        last_ns = std::max(last_ns, zone.end_ns);
+    }
+    for (const auto& thread : threads)
+    {
+        file << "{\"name\":\"counters\",\"ph\":\"C\",\"pid\":1"
+            << ",\"tid\":" << thread.thread_id
+            << ",\"ts\":" << 1.0e-3 * last_ns
+            << ",\"args\":{";
+        for (size_t k = 0; k < thread.counters.size(); ++k)
+        {
+            file << (k > 0 ? "," : "")
+                << "\"" << ProfileCounterName(static_cast<ProfileCounter>(k)) << "\":"
+                << thread.counters[k];
+        }
+        file << "}},\n";
+    }
+    file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"ProceduralTerrain\"}}\n";
+    file << "]}\n";
+    return true;
+}
+
+void Profiler::Reset()
+{
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    retired_totals.clear();
+    retired_trace.Clear();
+    retired_threads.clear();
+    for (auto* thread : live_threads)
+    {
+        std::lock_guard<std::mutex> thread_lock(thread->mutex);
+        thread->totals.clear();
+        thread->trace.Clear();
+        thread->busy_ns = 0;
+        for (auto& counter : thread->counters)
+            counter.store(0, std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,123 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+enum class ProfileCounter
+{
+    TexelsProcessed,
+    ParticlesUpdated,
+    ParticleResets,
+    Deposits,
+    BytesUploaded,
+    Count
+};
+
+const char* ProfileCounterName(ProfileCounter counter);
+
+
+struct ProfileZone
+{
+    const char* name;
+    int argument;
+    uint32_t thread_id;
+    int64_t start_ns;
+    int64_t end_ns;
+};
+
+struct ProfileZoneSummary
+{
+    std::string name;
+    uint64_t calls = 0;
+    double total_ms = 0.0;
+    double max_ms = 0.0;
+};
+
+struct ProfileThreadSummary
+{
+    uint32_t thread_id = 0;
+    double busy_ms = 0.0;
+    std::array<uint64_t, static_cast<size_t>(ProfileCounter::Count)> counters{};
+};
+
+struct ProfileSummary
+{
+    std::vector<ProfileZoneSummary> zones;
+    std::vector<ProfileThreadSummary> threads;
+    std::array<uint64_t, static_cast<size_t>(ProfileCounter::Count)> counters{};
+};
+
+
+/*
+Collects timed zones and counters per thread.
+Threads record into their own buffers, which are folded into shared
+retired totals when the thread exits, so recording never contends.
+Zones are summed per name as they are recorded, so memory and summary
+cost stay flat over a session; only the latest trace_zone_capacity zones
+of each thread are kept for the Chrome trace.
+*/
+class Profiler
+{
+public:
+    static const size_t trace_zone_capacity = 1 << 16;
+
+    static int64_t Now();
+
+    // Called by ProfileScope, zones must be recorded in the reverse order they began
+    static int64_t BeginZone();
+
+    static void RecordZone(const char* name, int argument, int64_t start_ns, int64_t end_ns);
+
+    static void AddCount(ProfileCounter counter, uint64_t amount);
+
+    static ProfileSummary GetSummary();
+
+    static bool WriteChromeTrace(const std::string& path);
+
+    static void Reset();
+};
+
+
+class ProfileScope
+{
+    const char* m_name;
+    int m_argument;
+    int64_t m_start_ns;
+
+public:
+    ProfileScope(const char* name, int argument = -1) :
+        m_name(name),
+        m_argument(argument),
+        m_start_ns(Profiler::BeginZone())
+    {
+    }
+
+    ~ProfileScope()
+    {
+        Profiler::RecordZone(m_name, m_argument, m_start_ns, Profiler::Now());
+    }
+};
+
+
+#define TERRAIN_PROFILE_CONCAT_INNER(a, b) a##b
+#define TERRAIN_PROFILE_CONCAT(a, b) TERRAIN_PROFILE_CONCAT_INNER(a, b)
+
+#ifdef PROCEDURAL_TERRAIN_PROFILING
+#define TERRAIN_PROFILE_SCOPE(name) \
+    ProfileScope TERRAIN_PROFILE_CONCAT(profile_scope_, __LINE__)(name)
+#define TERRAIN_PROFILE_SCOPE_ARG(name, argument) \
+    ProfileScope TERRAIN_PROFILE_CONCAT(profile_scope_, __LINE__)(name, argument)
+#define TERRAIN_PROFILE_COUNT(counter, amount) \
+    Profiler::AddCount(ProfileCounter::counter, amount)
+#else
+#define TERRAIN_PROFILE_SCOPE(name) ((void)0)
+#define TERRAIN_PROFILE_SCOPE_ARG(name, argument) ((void)0)
+#define TERRAIN_PROFILE_COUNT(counter, amount) ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,262 @@
+#include <cstring>
+#include "regeneration.hpp"
+#include "memory_arena.hpp"
+#include "parallel.hpp"
+#include "profiler.hpp"
+
+
+//////////////////////////////
+// STAGES
+//////////////////////////////
+// Stages that modify a map in place start from a copy of their input
+static void CopyCubemap(CubemapData& source, CubemapData& destination)
+{
+    size_t face_size = size_t(source.GetResolution()) * source.GetResolution() * source.GetChannelCount();
+    for (int face_id = CubeFace::Begin; face_id < CubeFace::End; ++face_id)
+    {
+        auto face = static_cast<CubeFace>(face_id);
+        std::memcpy(destination.GetFaceDataPointer(face), source.GetFaceDataPointer(face), face_size * sizeof(float));
+    }
+}
+
+static uint64_t HashNoiseParameters(const TerrainNoiseParameters& noise)
+{
+    uint64_t hash = HashValue(noise.seed);
+    hash = HashValue(noise.base_frequency, hash);
+    hash = HashValue(noise.octaves, hash);
+    hash = HashValue(noise.persistence, hash);
+    hash = HashValue(noise.frequency_multiplier, hash);
+    return HashValue(noise.height_scale, hash);
+}
+
+void AddTerrainStages(
+    StageGraph& graph,
+    const PlanetConfig& config,
+    const BiomeLookupTable& biome_table)
+{
+    // Un-eroded heightmaps get exact normals from the heightmap pass
+    bool heights_modified = config.erosion_steps > 0 || config.smooth_iterations > 0;
+    if (!heights_modified)
+    {
+        graph.AddStage(StageDefinition{
+            "Heightmap", {}, { { "height", 1 }, { "normal", 3 } },
+            HashNoiseParameters(config.noise),
+            [config](StageContext& context) {
+                GenerateNoiseHeightmap(context.outputs[0], context.outputs[1], config.noise, context.cancel);
+            } });
+    }
+    else
+    {
+        // Each height stage writes a new map, the last one is the final height
+        std::string height = config.erosion_steps > 0 ? "noise_height" : "smoothed_height";
+        graph.AddStage(StageDefinition{
+            "Heightmap", {}, { { height, 1 } },
+            HashNoiseParameters(config.noise),
+            [config](StageContext& context) {
+                GenerateNoiseHeightmap(context.outputs[0], config.noise, context.cancel);
+            } });
+
+        if (config.erosion_steps > 0)
+        {
+            std::string eroded = config.smooth_iterations > 0 ? "eroded_height" : "height";
+            graph.AddStage(StageDefinition{
+                "Erosion", { height }, { { eroded, 1 } },
+                HashValue(config.multigrid_erosion, HashValue(config.erosion_steps)),
+                [config](StageContext& context) {
+                    CopyCubemap(*context.inputs[0], *context.outputs[0]);
+                    if (config.multigrid_erosion)
+                    {
+                        MultigridErosionSettings erosion_settings;
+                        erosion_settings.coarse_steps = config.erosion_steps;
+                        erosion_settings.refinement_steps = config.erosion_steps / 10;
+                        erosion_settings.level_settings.cancel = context.cancel;
+                        ErodeHeightmapMultigrid(context.outputs[0], erosion_settings);
+                    }
+                    else
+                    {
+                        ErosionRunSettings erosion_settings;
+                        erosion_settings.max_steps = config.erosion_steps;
+                        erosion_settings.cancel = context.cancel;
+                        ErodeHeightmap(context.outputs[0], erosion_settings);
+                    }
+                } });
+            height = eroded;
+        }
+        if (config.smooth_iterations > 0)
+        {
+            graph.AddStage(StageDefinition{
+                "Smoothing", { height }, { { "height", 1 } },
+                HashValue(config.smooth_iterations),
+                [config](StageContext& context) {
+                    CopyCubemap(*context.inputs[0], *context.outputs[0]);
+                    SmoothMap(context.outputs[0], config.smooth_iterations, context.cancel);
+                } });
+        }
+
+        graph.AddStage(StageDefinition{
+            "Normals", { "height" }, { { "normal", 3 } },
+            0,
+            [](StageContext& context) {
+                CalculateNormalMap(context.inputs[0], context.outputs[0], context.cancel);
+            } });
+    }
+
+    HorizonBakeSettings horizon_settings;
+    uint64_t horizon_hash = HashValue(horizon_settings.azimuth_count);
+    horizon_hash = HashValue(horizon_settings.search_radius, horizon_hash);
+    horizon_hash = HashValue(horizon_settings.step_growth, horizon_hash);
+    graph.AddStage(StageDefinition{
+        "Horizon", { "height" }, { { "horizon", 4 } },
+        horizon_hash,
+        [horizon_settings](StageContext& context) {
+            BakeHorizonMap(context.inputs[0], context.outputs[0], horizon_settings, context.cancel);
+        } });
+
+    const BiomeLookupTable* table = &biome_table;
+    graph.AddStage(StageDefinition{
+        "Biomes", {}, { { "splat", 4 } },
+        biome_table.GetHash(),
+        [table](StageContext& context) {
+            GenerateBiomes(context.outputs[0], *table, context.cancel);
+        } });
+
+    graph.AddStage(StageDefinition{
+        "Material", { "splat" }, { { "material", 3 } },
+        0,
+        [](StageContext& context) {
+            GenerateMaterialIndexMap(context.inputs[0], context.outputs[0], context.cancel);
+        } });
+}
+
+
+//////////////////////////////
+// REGENERATOR
+//////////////////////////////
+TerrainRegenerator::TerrainRegenerator(double debounce_seconds) :
+    m_state(std::make_shared<SharedState>()),
+    m_debounce_seconds(debounce_seconds)
+{
+}
+
+TerrainRegenerator::~TerrainRegenerator()
+{
+    if (m_cancel != nullptr)
+        *m_cancel = true;
+}
+
+void TerrainRegenerator::Request(const PlanetConfig& config)
+{
+    m_pending = true;
+    m_pending_config = config;
+    m_last_request = std::chrono::steady_clock::now();
+}
+
+void TerrainRegenerator::Update()
+{
+    if (!m_pending)
+        return;
+    auto idle = std::chrono::steady_clock::now() - m_last_request;
+    if (std::chrono::duration<double>(idle).count() < m_debounce_seconds)
+        return;
+
+    if (m_cancel != nullptr)
+        *m_cancel = true;
+    m_cancel = std::make_shared<std::atomic<bool>>(false);
+    m_pending = false;
+
+    uint64_t generation;
+    {
+        std::lock_guard<std::mutex> lock(m_state->mutex);
+        generation = ++m_state->latest_generation;
+        m_state->running = true;
+    }
+    if (m_pending_config.resolution != m_launched_resolution)
+    {
+        m_launched_resolution = m_pending_config.resolution;
+        m_state->stage_cache.Clear();
+    }
+
+    // Old size maps can never be reused, free them instead of pooling.
+    // The erosion stage uses the default multigrid level layout.
+    std::vector<int> retained{ m_launched_resolution };
+    if (m_pending_config.erosion_steps > 0 && m_pending_config.multigrid_erosion)
+        retained = MultigridLevelResolutions(m_launched_resolution);
+    SharedTerrainArena().RetainResolutions(retained);
+
+    auto state = m_state;
+    auto cancel = m_cancel;
+    auto config = m_pending_config;
+    SharedThreadPool().Submit([state, cancel, config, generation]() {
+        RunJob(state, cancel, config, generation);
+    });
+}
+
+std::shared_ptr<TerrainMaps> TerrainRegenerator::TakeResult()
+{
+    std::lock_guard<std::mutex> lock(m_state->mutex);
+    auto result = m_state->result;
+    m_state->result = nullptr;
+    return result;
+}
+
+RegenerationStatus TerrainRegenerator::GetStatus()
+{
+    std::lock_guard<std::mutex> lock(m_state->mutex);
+    RegenerationStatus status;
+    status.pending = m_pending;
+    status.running = m_state->running;
+    status.completed = m_state->completed;
+    status.cancelled = m_state->cancelled;
+    status.last_seconds = m_state->last_seconds;
+    status.last_critical_path_seconds = m_state->last_critical_path_seconds;
+    status.last_stages_reused = m_state->last_stages_reused;
+    status.last_stage_count = m_state->last_stage_count;
+    return status;
+}
+
+void TerrainRegenerator::RunJob(
+    std::shared_ptr<SharedState> state,
+    std::shared_ptr<std::atomic<bool>> cancel,
+    PlanetConfig config,
+    uint64_t generation)
+{
+    TERRAIN_PROFILE_SCOPE("RegenerateTerrain");
+    auto start = std::chrono::steady_clock::now();
+    const std::atomic<bool>* flag = cancel.get();
+
+    StageGraph graph(config.resolution);
+    AddTerrainStages(graph, config, state->biome_table);
+    StageGraphReport report;
+    std::string error;
+    bool completed = graph.Run(report, error, &state->stage_cache, flag) && !report.cancelled;
+
+    auto maps = std::make_shared<TerrainMaps>();
+    maps->generation = generation;
+    maps->height_data = graph.GetMap("height");
+    maps->normal_data = graph.GetMap("normal");
+    maps->splat_data = graph.GetMap("splat");
+    maps->horizon_data = graph.GetMap("horizon");
+    maps->material_data = graph.GetMap("material");
+    maps->critical_path_seconds = report.critical_path_seconds;
+    maps->stages_reused = report.stages_reused;
+    maps->stage_count = static_cast<int>(report.stages.size());
+
+    auto stop = std::chrono::steady_clock::now();
+    maps->seconds = std::chrono::duration<double>(stop - start).count();
+
+    std::lock_guard<std::mutex> lock(state->mutex);
+    bool latest = generation == state->latest_generation;
+    if (latest)
+        state->running = false;
+    if (!completed || *flag || !latest)
+    {
+        state->cancelled++;
+        return;
+    }
+    state->result = maps;
+    state->completed++;
+    state->last_seconds = maps->seconds;
+    state->last_critical_path_seconds = maps->critical_path_seconds;
+    state->last_stages_reused = maps->stages_reused;
+    state->last_stage_count = maps->stage_count;
+}
@@ -0,0 +1,116 @@
+#ifndef REGENERATION_HPP
+#define REGENERATION_HPP
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include "batch.hpp"
+#include "horizon.hpp"
+#include "stage_graph.hpp"
+
+
+// Finished maps of one regeneration, ready to upload
+struct TerrainMaps
+{
+    uint64_t generation = 0;
+    double seconds = 0.0;
+    double critical_path_seconds = 0.0;
+    int stages_reused = 0;
+    int stage_count = 0;
+    std::shared_ptr<CubemapData> height_data = nullptr;
+    std::shared_ptr<CubemapData> normal_data = nullptr;
+    std::shared_ptr<CubemapData> splat_data = nullptr;
+    std::shared_ptr<CubemapData> horizon_data = nullptr;
+    std::shared_ptr<CubemapData> material_data = nullptr;
+};
+
+struct RegenerationStatus
+{
+    bool pending = false;
+    bool running = false;
+    uint64_t completed = 0;
+    uint64_t cancelled = 0;
+    double last_seconds = 0.0;
+    double last_critical_path_seconds = 0.0;
+    int last_stages_reused = 0;
+    int last_stage_count = 0;
+};
+
+
+/*
+Adds the editor pipeline for config to graph. Biomes only depend on the
+texel directions, so they run alongside the heightmap, and the horizon
+bake runs alongside the normals once the final heights exist.
+The finished maps are named height, normal, splat, horizon and material.
+*/
+void AddTerrainStages(
+    StageGraph& graph,
+    const PlanetConfig& config,
+    const BiomeLookupTable& biome_table);
+
+
+/*
+Regenerates terrain maps on the shared thread pool while the editor runs.
+Request only records the latest config; Update launches it once no new
+request has arrived for the debounce time. Launching cancels the running
+job, which stops at its next row tile and drops its maps. Only the newest
+job publishes, and TakeResult hands its maps over as a whole.
+Stage outputs are cached between jobs, so an edit only reruns the stages
+that depend on what changed. Changing the resolution drops the cache and
+the arena's pooled maps of the old size, multigrid erosion levels of the
+new size stay pooled.
+None of the UI thread calls wait on generation.
+*/
+class TerrainRegenerator
+{
+    struct SharedState
+    {
+        BiomeLookupTable biome_table{ DefaultBiomeDefinitions() };
+        StageCache stage_cache;
+        std::mutex mutex;
+        uint64_t latest_generation = 0;
+        std::shared_ptr<TerrainMaps> result = nullptr;
+        bool running = false;
+        uint64_t completed = 0;
+        uint64_t cancelled = 0;
+        double last_seconds = 0.0;
+        double last_critical_path_seconds = 0.0;
+        int last_stages_reused = 0;
+        int last_stage_count = 0;
+    };
+
+    std::shared_ptr<SharedState> m_state;
+    std::shared_ptr<std::atomic<bool>> m_cancel = nullptr;
+    double m_debounce_seconds;
+
+    bool m_pending = false;
+    PlanetConfig m_pending_config;
+    int m_launched_resolution = 0;
+    std::chrono::steady_clock::time_point m_last_request;
+
+public:
+    TerrainRegenerator(double debounce_seconds = 0.25);
+
+    // Running jobs are cancelled and finish on their own, nothing waits for them
+    ~TerrainRegenerator();
+
+    void Request(const PlanetConfig& config);
+
+    // Call once per frame from the UI thread
+    void Update();
+
+    // Newest finished maps not yet taken, or nullptr
+    std::shared_ptr<TerrainMaps> TakeResult();
+
+    RegenerationStatus GetStatus();
+
+private:
+    static void RunJob(
+        std::shared_ptr<SharedState> state,
+        std::shared_ptr<std::atomic<bool>> cancel,
+        PlanetConfig config,
+        uint64_t generation);
+};
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef SCENE_FRAME_HPP
+#define SCENE_FRAME_HPP
+#include <memory>
+#include "profiler.hpp"
+#include "regeneration.hpp"
+#include "terrain_shading.hpp"
+
+
+/*
+CPU side of a SceneLayer frame, everything OnUpdate does before it renders.
+Editor changes from the previous frame go up with the time uniform in one
+flush, then the regenerator is polled for finished maps. Kept out of the
+layer so the frame benchmark runs the same code against the null uniform
+backend.
+*/
+class SceneFrame
+{
+    std::shared_ptr<TerrainShadingUniforms> m_uniforms = nullptr;
+    std::shared_ptr<TerrainRegenerator> m_regenerator = nullptr;
+    float m_time_elapsed = 0.0f;
+
+public:
+    SceneFrame(
+        const std::shared_ptr<TerrainShadingUniforms>& uniforms,
+        const std::shared_ptr<TerrainRegenerator>& regenerator) :
+        m_uniforms(uniforms),
+        m_regenerator(regenerator)
+    {
+    }
+
+    // Returns maps to upload this frame, or nullptr
+    std::shared_ptr<TerrainMaps> Update(float time_step, UniformTarget& target)
+    {
+        TERRAIN_PROFILE_SCOPE("FrameUpdate");
+        m_time_elapsed += time_step;
+        m_uniforms->SetTime(m_time_elapsed);
+        m_uniforms->Flush(target);
+
+        m_regenerator->Update();
+        return m_regenerator->TakeResult();
+    }
+};
+
+#endif
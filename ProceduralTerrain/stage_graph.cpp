@@ -0,0 +1,313 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include "stage_graph.hpp"
+#include "memory_arena.hpp"
+#include "parallel.hpp"
+#include "profiler.hpp"
+
+
+static inline bool IsCancelled(const std::atomic<bool>* cancel)
+{
+    return cancel != nullptr && cancel->load(std::memory_order_relaxed);
+}
+
+uint64_t HashBytes(const void* data, size_t size, uint64_t hash)
+{
+    auto bytes = static_cast<const unsigned char*>(data);
+    for (size_t k = 0; k < size; ++k)
+    {
+        hash ^= bytes[k];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+
+//////////////////////////////
+// CACHE
+//////////////////////////////
+bool StageCache::Find(const std::string& stage, uint64_t key, std::vector<std::shared_ptr<CubemapData>>& outputs)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto entry = m_entries.find(stage);
+    if (entry == m_entries.end() || entry->second.key != key)
+        return false;
+    outputs = entry->second.outputs;
+    return true;
+}
+
+void StageCache::Store(const std::string& stage, uint64_t key, const std::vector<std::shared_ptr<CubemapData>>& outputs)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto& entry = m_entries[stage];
+    entry.key = key;
+    entry.outputs = outputs;
+}
+
+void StageCache::Clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_entries.clear();
+}
+
+
+//////////////////////////////
+// EXECUTION
+//////////////////////////////
+// Pool helpers hold this past the end of Run, they only touch the graph after taking a stage
+struct StageGraphRun
+{
+    const std::vector<StageDefinition>* stages = nullptr;
+    std::map<std::string, std::shared_ptr<CubemapData>>* maps = nullptr;
+    StageCache* cache = nullptr;
+    const std::atomic<bool>* cancel = nullptr;
+    int resolution = 0;
+    int stage_count = 0;
+    std::vector<uint64_t> keys;
+    std::vector<std::vector<int>> dependents;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::vector<int> pending_inputs;
+    std::deque<int> ready;
+    int running = 0;
+    int finished = 0;
+    bool cancelled = false;
+    std::vector<StageTiming> timings;
+};
+
+static void SubmitStageHelpers(std::shared_ptr<StageGraphRun> run, int count);
+
+/*
+Takes one ready stage and runs or reuses it. Returns false once nothing is
+ready; with wait set it first blocks until a stage is ready or the run is
+over, which is only the case when every stage finished or was cancelled.
+*/
+static bool RunNextStage(const std::shared_ptr<StageGraphRun>& run, bool wait)
+{
+    std::unique_lock<std::mutex> lock(run->mutex);
+    if (wait)
+    {
+        run->changed.wait(lock, [&run]() {
+            if (run->cancelled)
+                return run->running == 0;
+            return !run->ready.empty() || run->finished == run->stage_count;
+        });
+    }
+    if (run->cancelled || run->ready.empty())
+        return false;
+
+    int index = run->ready.front();
+    run->ready.pop_front();
+    run->running++;
+    const auto& stage = (*run->stages)[index];
+    StageContext context;
+    context.cancel = run->cancel;
+    for (const auto& input : stage.inputs)
+        context.inputs.push_back(run->maps->at(input));
+    lock.unlock();
+
+    TERRAIN_PROFILE_SCOPE_ARG("StageGraph/Stage", index);
+    auto start = std::chrono::steady_clock::now();
+    bool reused = run->cache != nullptr && run->cache->Find(stage.name, run->keys[index], context.outputs);
+    if (!reused)
+    {
+        for (const auto& output : stage.outputs)
+            context.outputs.push_back(SharedTerrainArena().AcquireCubemap(run->resolution, output.channels));
+        stage.run(context);
+    }
+    auto stop = std::chrono::steady_clock::now();
+
+    // A cancelled pass may have stopped part way, so its outputs are never cached
+    bool cancelled = !reused && IsCancelled(run->cancel);
+    if (!reused && !cancelled && run->cache != nullptr)
+        run->cache->Store(stage.name, run->keys[index], context.outputs);
+
+    lock.lock();
+    run->running--;
+    auto& timing = run->timings[index];
+    timing.reused = reused;
+    timing.seconds = reused ? 0.0 : std::chrono::duration<double>(stop - start).count();
+
+    int newly_ready = 0;
+    if (cancelled)
+        run->cancelled = true;
+    else
+    {
+        for (size_t k = 0; k < stage.outputs.size(); ++k)
+            (*run->maps)[stage.outputs[k].map] = context.outputs[k];
+        run->finished++;
+        for (int dependent : run->dependents[index])
+        {
+            if (--run->pending_inputs[dependent] == 0)
+            {
+                run->ready.push_back(dependent);
+                newly_ready++;
+            }
+        }
+    }
+
+    // This thread takes one of the new stages itself
+    int idle_threads = GetWorkerThreadCount() - run->running - 1;
+    int helper_count = std::min(newly_ready - 1, idle_threads);
+    lock.unlock();
+    run->changed.notify_all();
+    SubmitStageHelpers(run, helper_count);
+    return true;
+}
+
+static void SubmitStageHelpers(std::shared_ptr<StageGraphRun> run, int count)
+{
+    for (int k = 0; k < count; ++k)
+    {
+        SharedThreadPool().Submit([run]() {
+            while (RunNextStage(run, false))
+            {
+            }
+        });
+    }
+}
+
+
+//////////////////////////////
+// GRAPH
+//////////////////////////////
+StageGraph::StageGraph(int resolution) :
+    m_resolution(resolution)
+{
+}
+
+void StageGraph::AddStage(StageDefinition stage)
+{
+    m_stages.push_back(std::move(stage));
+}
+
+bool StageGraph::Run(
+    StageGraphReport& report,
+    std::string& error,
+    StageCache* cache,
+    const std::atomic<bool>* cancel)
+{
+    TERRAIN_PROFILE_SCOPE("StageGraph");
+    int stage_count = static_cast<int>(m_stages.size());
+    auto run = std::make_shared<StageGraphRun>();
+    run->stages = &m_stages;
+    run->maps = &m_maps;
+    run->cache = cache;
+    run->cancel = cancel;
+    run->resolution = m_resolution;
+    run->stage_count = stage_count;
+    run->keys.resize(stage_count);
+    run->dependents.resize(stage_count);
+    run->pending_inputs.resize(stage_count);
+    run->timings.resize(stage_count);
+    m_maps.clear();
+
+    // Edges from producers to consumers, one per declared input
+    std::map<std::string, int> producers;
+    for (int index = 0; index < stage_count; ++index)
+    {
+        run->timings[index].name = m_stages[index].name;
+        for (const auto& output : m_stages[index].outputs)
+        {
+            auto inserted = producers.emplace(output.map, index);
+            if (!inserted.second)
+            {
+                error = "Map " + output.map + " is produced by both " +
+                    m_stages[inserted.first->second].name + " and " + m_stages[index].name;
+                return false;
+            }
+        }
+    }
+    std::vector<std::vector<int>> producer_stages(stage_count);
+    for (int index = 0; index < stage_count; ++index)
+    {
+        for (const auto& input : m_stages[index].inputs)
+        {
+            auto producer = producers.find(input);
+            if (producer == producers.end())
+            {
+                error = "Stage " + m_stages[index].name + " reads map " + input + " which no stage produces";
+                return false;
+            }
+            producer_stages[index].push_back(producer->second);
+            run->dependents[producer->second].push_back(index);
+            run->pending_inputs[index]++;
+        }
+    }
+
+    // Producers come first, so keys can chain their inputs' keys
+    std::vector<int> order;
+    std::vector<int> unordered_inputs = run->pending_inputs;
+    for (int index = 0; index < stage_count; ++index)
+    {
+        if (unordered_inputs[index] == 0)
+            order.push_back(index);
+    }
+    for (size_t k = 0; k < order.size(); ++k)
+    {
+        for (int dependent : run->dependents[order[k]])
+        {
+            if (--unordered_inputs[dependent] == 0)
+                order.push_back(dependent);
+        }
+    }
+    if (static_cast<int>(order.size()) != stage_count)
+    {
+        error = "Stages form a cycle";
+        return false;
+    }
+
+    for (int index : order)
+    {
+        const auto& stage = m_stages[index];
+        uint64_t key = HashString(stage.name);
+        key = HashValue(stage.parameter_hash, key);
+        key = HashValue(m_resolution, key);
+        for (const auto& output : stage.outputs)
+            key = HashValue(output.channels, HashString(output.map, key));
+        for (size_t k = 0; k < stage.inputs.size(); ++k)
+            key = HashValue(run->keys[producer_stages[index][k]], HashString(stage.inputs[k], key));
+        run->keys[index] = key;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (int index = 0; index < stage_count; ++index)
+    {
+        if (run->pending_inputs[index] == 0)
+            run->ready.push_back(index);
+    }
+    SubmitStageHelpers(run, std::min(static_cast<int>(run->ready.size()), GetWorkerThreadCount()) - 1);
+    while (RunNextStage(run, true))
+    {
+    }
+    auto stop = std::chrono::steady_clock::now();
+
+    std::lock_guard<std::mutex> lock(run->mutex);
+    report = StageGraphReport();
+    report.stages = run->timings;
+    report.cancelled = run->cancelled;
+    report.wall_seconds = std::chrono::duration<double>(stop - start).count();
+    for (int index : order)
+    {
+        auto& timing = report.stages[index];
+        double longest_input = 0.0;
+        for (int producer : producer_stages[index])
+            longest_input = std::max(longest_input, report.stages[producer].path_seconds);
+        timing.path_seconds = longest_input + timing.seconds;
+        report.stages_reused += timing.reused ? 1 : 0;
+        report.stage_seconds += timing.seconds;
+        report.critical_path_seconds = std::max(report.critical_path_seconds, timing.path_seconds);
+    }
+    if (report.cancelled)
+        m_maps.clear();
+    return true;
+}
+
+std::shared_ptr<CubemapData> StageGraph::GetMap(const std::string& name) const
+{
+    auto map = m_maps.find(name);
+    return map == m_maps.end() ? nullptr : map->second;
+}
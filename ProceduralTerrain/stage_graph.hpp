@@ -0,0 +1,150 @@
+#ifndef STAGE_GRAPH_HPP
+#define STAGE_GRAPH_HPP
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <Merlin/Render/cubemap_data.hpp>
+
+using namespace Merlin;
+
+
+static const uint64_t stage_hash_seed = 14695981039346656037ull;
+
+// FNV-1a, pass a previous hash to chain values
+uint64_t HashBytes(const void* data, size_t size, uint64_t hash = stage_hash_seed);
+
+template<typename T>
+inline uint64_t HashValue(const T& value, uint64_t hash = stage_hash_seed)
+{
+    static_assert(std::is_trivially_copyable<T>::value, "hash fields of structs with padding one by one");
+    return HashBytes(&value, sizeof(T), hash);
+}
+
+inline uint64_t HashString(const std::string& value, uint64_t hash = stage_hash_seed)
+{
+    return HashBytes(value.data(), value.size(), HashValue(value.size(), hash));
+}
+
+
+struct StageOutput
+{
+    std::string map;
+    int channels = 1;
+};
+
+// Maps in the order the stage declared them; inputs are shared and must not be modified
+struct StageContext
+{
+    std::vector<std::shared_ptr<CubemapData>> inputs;
+    std::vector<std::shared_ptr<CubemapData>> outputs;
+    const std::atomic<bool>* cancel = nullptr;
+};
+
+/*
+One node of a stage graph. Inputs name maps produced by other stages,
+outputs are acquired from the terrain arena before run is called and
+must be completely overwritten. parameter_hash covers everything besides
+the inputs that the outputs depend on.
+*/
+struct StageDefinition
+{
+    std::string name;
+    std::vector<std::string> inputs;
+    std::vector<StageOutput> outputs;
+    uint64_t parameter_hash = 0;
+    std::function<void(StageContext&)> run;
+};
+
+
+/*
+Outputs of the latest completed run of each stage, by stage name.
+A stage is reused while its key, the hash of its parameters, outputs and
+its inputs' keys, is unchanged, so an edit only reruns the stages
+downstream of it. Cached maps are shared with every later result.
+*/
+class StageCache
+{
+    struct Entry
+    {
+        uint64_t key = 0;
+        std::vector<std::shared_ptr<CubemapData>> outputs;
+    };
+
+    std::mutex m_mutex;
+    std::map<std::string, Entry> m_entries;
+
+public:
+    bool Find(const std::string& stage, uint64_t key, std::vector<std::shared_ptr<CubemapData>>& outputs);
+
+    void Store(const std::string& stage, uint64_t key, const std::vector<std::shared_ptr<CubemapData>>& outputs);
+
+    // Drops every entry, maps still held by results stay alive
+    void Clear();
+};
+
+
+struct StageTiming
+{
+    std::string name;
+    bool reused = false;
+    double seconds = 0.0;
+    // Longest chain of stage times from a source up to the end of this stage
+    double path_seconds = 0.0;
+};
+
+struct StageGraphReport
+{
+    std::vector<StageTiming> stages;
+    int stages_reused = 0;
+    bool cancelled = false;
+    double wall_seconds = 0.0;
+    // Sum over stages, what a serial pipeline would take
+    double stage_seconds = 0.0;
+    // Lower bound on the wall time with enough threads for every independent stage
+    double critical_path_seconds = 0.0;
+};
+
+
+/*
+Pipeline expressed as stages with declared input and output maps.
+Every map has exactly one producing stage. Run orders the stages by their
+inputs and starts each one as soon as its producers finish, so stages
+that do not depend on each other run at the same time on the shared
+thread pool. The calling thread runs stages too, so a run started from
+a pool worker always makes progress.
+*/
+class StageGraph
+{
+    int m_resolution;
+    std::vector<StageDefinition> m_stages;
+    std::map<std::string, std::shared_ptr<CubemapData>> m_maps;
+
+public:
+    explicit StageGraph(int resolution);
+
+    void AddStage(StageDefinition stage);
+
+    /*
+    Runs or reuses every stage. Returns false and fills error when an input
+    has no producer, a map has two or the stages form a cycle. A set cancel
+    flag stops the run after the running stages, none of their outputs are
+    cached and report.cancelled is set.
+    */
+    bool Run(
+        StageGraphReport& report,
+        std::string& error,
+        StageCache* cache = nullptr,
+        const std::atomic<bool>* cancel = nullptr);
+
+    // Output of the last run, nullptr for unknown maps
+    std::shared_ptr<CubemapData> GetMap(const std::string& name) const;
+};
+
+#endif
@@ -0,0 +1,702 @@
+#include <array>
+#include <cstring>
+#include "terrain.hpp"
+#include "noise3d.hpp"
+#include "cube_sphere.hpp"
+#include "cubemap_geometry.hpp"
+#include "cubemap_view.hpp"
+#include "erosion.hpp"
+#include "memory_arena.hpp"
+#include "parallel.hpp"
+#include "profiler.hpp"
+
+
+static inline bool IsCancelled(const std::atomic<bool>* cancel)
+{
+    return cancel != nullptr && cancel->load(std::memory_order_relaxed);
+}
+
+// Texel math shared by the whole map passes and GenerateTerrainTile
+static inline float NoiseHeight(
+    const glm::vec3& point,
+    const TerrainNoiseParameters& parameters,
+    const glm::vec3& seed_offset)
+{
+    float ridge_noise = FractalRidgeNoise(
+        point + seed_offset,
+        parameters.base_frequency,
+        parameters.octaves,
+        parameters.persistence,
+        parameters.frequency_multiplier);
+    return 0.5f + parameters.height_scale * ridge_noise;
+}
+
+// Normal is returned encoded as 0.5 (n + 1)
+static inline float NoiseHeightAndNormal(
+    const glm::vec3& point,
+    const TerrainNoiseParameters& parameters,
+    const glm::vec3& seed_offset,
+    glm::vec3& normal)
+{
+    auto ridge_noise = FractalRidgeNoiseGradient(
+        point + seed_offset,
+        parameters.base_frequency,
+        parameters.octaves,
+        parameters.persistence,
+        parameters.frequency_multiplier);
+    float height = 0.5f + parameters.height_scale * ridge_noise.value;
+
+    // Surface r(d) = R(d) d has normal d - grad_s(R) / R, grad_s being the tangential gradient
+    float radius = 0.5f + height;
+    glm::vec3 gradient = parameters.height_scale * ridge_noise.gradient;
+    glm::vec3 tangential_gradient = gradient - glm::dot(gradient, point) * point;
+    normal = glm::normalize(point - tangential_gradient / radius);
+    normal = 0.5f * (normal + 1.0f);
+    return height;
+}
+
+/*
+Temperature and rainfall perturbations, both low frequency.
+The offset keeps points with small rational coordinates, such as lattice
+corners on cube edges, off the noise lattice vertices where glm::simplex
+jumps to a spurious value.
+*/
+static inline glm::vec2 ClimateNoise(const glm::vec3& point)
+{
+    const glm::vec3 offset(0.0013f, 15.0029f, 0.0047f);
+    return glm::vec2(
+        0.1f * SmoothNoise(5.0f * point + offset),
+        0.4f * SmoothNoise(3.0f * point + offset));
+}
+
+// Temperature and rainfall, sin^2(2T) expanded in terms of cos(T)
+static inline glm::vec2 BiomeClimate(const glm::vec3& point, const glm::vec2& noise)
+{
+    float cos_sq = point.y * point.y;
+    float sin_sq = 1.0f - cos_sq;
+
+    float t = sin_sq;
+    t += noise.x;
+
+    float r = 4.0f * sin_sq * cos_sq;
+    r += noise.y;
+
+    return glm::vec2(glm::clamp(t, 0.0f, 1.0f), glm::clamp(r, 0.0f, 1.0f));
+}
+
+/*
+Above this resolution the climate noise is sampled at the corners of a
+lattice with this many cells along a face edge and interpolated per texel,
+a cell still spans under a tenth of the shortest noise wavelength. Corners
+on a face edge lie on the cube edge, so neighbouring faces agree there.
+*/
+static const int climate_lattice_cells = 128;
+
+static inline glm::vec2 ClimateLatticeNoise(CubeFace face, int a, int b)
+{
+    return ClimateNoise(glm::normalize(CubemapData::CubePoint(CubemapCoordinates{
+        face,
+        float(a) / climate_lattice_cells,
+        float(b) / climate_lattice_cells })));
+}
+
+// Lattice rows start at corner (a0, b0) and hold stride corners
+static inline glm::vec2 InterpolateClimateNoise(
+    const glm::vec2* lattice,
+    int a0,
+    int b0,
+    int stride,
+    int i,
+    int j,
+    int resolution)
+{
+    float scale = float(climate_lattice_cells) / resolution;
+    float x = (i + 0.5f) * scale;
+    float y = (j + 0.5f) * scale;
+    int a = static_cast<int>(x);
+    int b = static_cast<int>(y);
+    float fx = x - a;
+    float fy = y - b;
+
+    const glm::vec2* row0 = lattice + size_t(b - b0) * stride + (a - a0);
+    const glm::vec2* row1 = row0 + stride;
+    glm::vec2 n0 = row0[0] + fx * (row0[1] - row0[0]);
+    glm::vec2 n1 = row1[0] + fx * (row1[1] - row1[0]);
+    return n0 + fy * (n1 - n0);
+}
+
+void GenerateNoiseHeightmap(
+    std::shared_ptr<CubemapData>& height_data,
+    const TerrainNoiseParameters& parameters,
+    const std::atomic<bool>* cancel)
+{
+    TERRAIN_PROFILE_SCOPE("GenerateNoiseHeightmap");
+    int resolution = height_data->GetResolution();
+    glm::vec3 seed_offset = NoiseSeedOffset(parameters.seed);
+    auto geometry = SharedCubemapGeometry(resolution);
+    CubemapView<float, 1> heights(*height_data);
+    auto work = [&heights, &geometry, &parameters, seed_offset, resolution, cancel](int row) {
+        if (IsCancelled(cancel))
+            return;
+        auto face = static_cast<Merlin::CubeFace>(row / resolution);
+        int j = row % resolution;
+        TERRAIN_PROFILE_SCOPE_ARG("GenerateNoiseHeightmap/Row", face);
+        TERRAIN_PROFILE_COUNT(TexelsProcessed, resolution);
+        float* height_row = heights.Row(face, j);
+        for (int i = 0; i < resolution; ++i)
+        {
+            auto point = geometry->Direction(face, i, j);
+            height_row[i] = NoiseHeight(point, parameters, seed_offset);
+        }
+    };
+    ParallelFor(6 * resolution, work);
+}
+
+void GenerateNoiseHeightmap(
+    std::shared_ptr<CubemapData>& height_data,
+    std::shared_ptr<CubemapData>& normal_data,
+    const TerrainNoiseParameters& parameters,
+    const std::atomic<bool>* cancel)
+{
+    TERRAIN_PROFILE_SCOPE("GenerateNoiseHeightmap");
+    int resolution = height_data->GetResolution();
+    glm::vec3 seed_offset = NoiseSeedOffset(parameters.seed);
+    auto geometry = SharedCubemapGeometry(resolution);
+    CubemapView<float, 1> heights(*height_data);
+    CubemapView<float, 3> normals(*normal_data);
+    auto work = [&heights, &normals, &geometry, &parameters, seed_offset, resolution, cancel](int row) {
+        if (IsCancelled(cancel))
+            return;
+        auto face = static_cast<Merlin::CubeFace>(row / resolution);
+        int j = row % resolution;
+        TERRAIN_PROFILE_SCOPE_ARG("GenerateNoiseHeightmap/Row", face);
+        TERRAIN_PROFILE_COUNT(TexelsProcessed, resolution);
+        float* height_row = heights.Row(face, j);
+        glm::vec3* normal_row = normals.Row(face, j);
+        for (int i = 0; i < resolution; ++i)
+        {
+            auto point = geometry->Direction(face, i, j);
+            height_row[i] = NoiseHeightAndNormal(point, parameters, seed_offset, normal_row[i]);
+        }
+    };
+    ParallelFor(6 * resolution, work);
+}
+
+// Sums |height - snapshot| weighted by texel area over all texels and refreshes the snapshot
+static double AbsoluteHeightChange(CubemapData& height_data, float* snapshot)
+{
+    size_t face_count = size_t(height_data.GetResolution()) * height_data.GetResolution();
+    auto geometry = SharedCubemapGeometry(height_data.GetResolution());
+    ConstCubemapView<1> height_view(height_data);
+    std::array<double, 6> face_change{};
+    ParallelFor(6, [&](int face_id) {
+        auto face = static_cast<CubeFace>(face_id);
+        const float* heights = height_view.Face(face);
+        const float* solid_angles = geometry->SolidAngles(face).data();
+        float* previous = snapshot + face_id * face_count;
+        double change = 0.0;
+        for (size_t k = 0; k < face_count; ++k)
+        {
+            change += solid_angles[k] * glm::abs(heights[k] - previous[k]);
+            previous[k] = heights[k];
+        }
+        face_change[face_id] = change;
+    });
+
+    double total_change = 0.0;
+    for (double change : face_change)
+        total_change += change;
+    return total_change;
+}
+
+int ErodeHeightmap(
+    std::shared_ptr<CubemapData>& height_data,
+    const ErosionRunSettings& settings)
+{
+    TERRAIN_PROFILE_SCOPE("ErodeHeightmap");
+    auto erosion_params = DefaultErosionParameters(height_data->GetResolution());
+
+    bool checkpoints_enabled = !settings.checkpoint_path.empty();
+    ErosionCheckpoint state;
+    bool resumed = (
+        checkpoints_enabled &&
+        settings.resume_from_checkpoint &&
+        LoadErosionCheckpoint(settings.checkpoint_path, *height_data, state));
+    if (!resumed)
+    {
+        state = ErosionCheckpoint();
+        state.particles.resize(settings.n_particles);
+        for (auto& p : state.particles) { InitializeParticle(p, erosion_params); }
+    }
+
+    // The snapshot for the convergence test is only kept when the test is enabled
+    bool check_convergence = settings.convergence_tolerance > 0.0f;
+    size_t face_count = size_t(height_data->GetResolution()) * height_data->GetResolution();
+    auto snapshot = SharedTerrainArena().AcquireBuffer(check_convergence ? 6 * face_count : 0);
+    if (check_convergence)
+        AbsoluteHeightChange(*height_data, snapshot.data());
+
+    int interval = glm::max(settings.convergence_interval, 1);
+    int interval_start = state.step;
+    while (state.step < settings.max_steps && !IsCancelled(settings.cancel))
+    {
+        for (auto& p : state.particles)
+            UpdateParticle(p, *height_data, erosion_params);
+        state.step++;
+
+        if (check_convergence && state.step - interval_start >= interval)
+        {
+            interval_start = state.step;
+            double change = AbsoluteHeightChange(*height_data, snapshot.data());
+            if (state.reference_change <= 0.0)
+                state.reference_change = change;
+            else if (change < settings.convergence_tolerance * state.reference_change)
+                break;
+        }
+
+        if (checkpoints_enabled &&
+            settings.checkpoint_interval > 0 &&
+            state.step % settings.checkpoint_interval == 0)
+        {
+            TERRAIN_PROFILE_SCOPE("ErodeHeightmap/Checkpoint");
+            SaveErosionCheckpoint(settings.checkpoint_path, *height_data, state);
+        }
+    }
+
+    if (checkpoints_enabled)
+        SaveErosionCheckpoint(settings.checkpoint_path, *height_data, state);
+
+    return state.step;
+}
+
+// 2x2 box filter of a single channel map into one of half the resolution
+static std::shared_ptr<CubemapData> DownsampleHeightmap(std::shared_ptr<CubemapData>& fine_data)
+{
+    int coarse_resolution = fine_data->GetResolution() / 2;
+    auto coarse_data = SharedTerrainArena().AcquireCubemap(coarse_resolution, 1);
+    ConstCubemapView<1> fine(*fine_data);
+    CubemapView<float, 1> coarse(*coarse_data);
+    auto work = [&fine, &coarse, coarse_resolution](int row) {
+        auto face = static_cast<CubeFace>(row / coarse_resolution);
+        int j = row % coarse_resolution;
+        const float* fine_row0 = fine.Row(face, 2 * j);
+        const float* fine_row1 = fine.Row(face, 2 * j + 1);
+        float* coarse_row = coarse.Row(face, j);
+        for (int i = 0; i < coarse_resolution; ++i)
+        {
+            coarse_row[i] = 0.25f * (
+                fine_row0[2 * i] +
+                fine_row0[2 * i + 1] +
+                fine_row1[2 * i] +
+                fine_row1[2 * i + 1]);
+        }
+    };
+    ParallelFor(6 * coarse_resolution, work);
+    return coarse_data;
+}
+
+// Adds the bilinearly upsampled difference (after - before) of a coarse level onto a finer one
+static void AddUpsampledChange(
+    std::shared_ptr<CubemapData>& fine_data,
+    std::shared_ptr<CubemapData>& coarse_after,
+    std::shared_ptr<CubemapData>& coarse_before)
+{
+    int coarse_resolution = coarse_after->GetResolution();
+    auto change_data = SharedTerrainArena().AcquireCubemap(coarse_resolution, 1);
+    ConstCubemapView<1> after(*coarse_after);
+    ConstCubemapView<1> before(*coarse_before);
+    CubemapView<float, 1> change(*change_data);
+    auto difference = [&](int row) {
+        auto face = static_cast<CubeFace>(row / coarse_resolution);
+        int j = row % coarse_resolution;
+        const float* after_row = after.Row(face, j);
+        const float* before_row = before.Row(face, j);
+        float* change_row = change.Row(face, j);
+        for (int i = 0; i < coarse_resolution; ++i)
+            change_row[i] = after_row[i] - before_row[i];
+    };
+    ParallelFor(6 * coarse_resolution, difference);
+
+    int fine_resolution = fine_data->GetResolution();
+    CubemapView<float, 1> fine(*fine_data);
+    auto upsample = [&](int row) {
+        auto face = static_cast<CubeFace>(row / fine_resolution);
+        int j = row % fine_resolution;
+        float* fine_row = fine.Row(face, j);
+        for (int i = 0; i < fine_resolution; ++i)
+        {
+            auto coordinates = fine_data->GetPixelCoordinates(face, i, j);
+            fine_row[i] += BilinearInterpolate(*change_data, coordinates, 0);
+        }
+    };
+    ParallelFor(6 * fine_resolution, upsample);
+}
+
+std::vector<int> MultigridLevelResolutions(
+    int resolution,
+    const MultigridErosionSettings& settings)
+{
+    // Level 0 is the full resolution map, each following level halves it
+    std::vector<int> resolutions{ resolution };
+    while (static_cast<int>(resolutions.size()) < settings.n_levels)
+    {
+        int finer = resolutions.back();
+        if (finer % 2 != 0 || finer / 2 < settings.min_resolution)
+            break;
+        resolutions.push_back(finer / 2);
+    }
+    return resolutions;
+}
+
+int ErodeHeightmapMultigrid(
+    std::shared_ptr<CubemapData>& height_data,
+    const MultigridErosionSettings& settings)
+{
+    TERRAIN_PROFILE_SCOPE("ErodeHeightmapMultigrid");
+
+    size_t level_count = MultigridLevelResolutions(height_data->GetResolution(), settings).size();
+    std::vector<std::shared_ptr<CubemapData>> levels{ height_data };
+    while (levels.size() < level_count)
+        levels.push_back(DownsampleHeightmap(levels.back()));
+
+    // Multigrid levels are short lived, so they are never checkpointed
+    ErosionRunSettings level_settings = settings.level_settings;
+    level_settings.checkpoint_path.clear();
+    level_settings.resume_from_checkpoint = false;
+
+    int total_steps = 0;
+    std::shared_ptr<CubemapData> coarse_before = nullptr;
+    for (int level = static_cast<int>(levels.size()) - 1; level >= 0; --level)
+    {
+        TERRAIN_PROFILE_SCOPE_ARG("ErodeHeightmapMultigrid/Level", level);
+        auto& level_data = levels[level];
+        if (coarse_before != nullptr)
+            AddUpsampledChange(level_data, levels[level + 1], coarse_before);
+
+        // Keep the pre-erosion state so the next finer level only receives the change
+        if (level > 0)
+        {
+            coarse_before = SharedTerrainArena().AcquireCubemap(level_data->GetResolution(), 1);
+            size_t face_size = size_t(level_data->GetResolution()) * level_data->GetResolution() * sizeof(float);
+            for (int face_id = CubeFace::Begin; face_id < CubeFace::End; ++face_id)
+            {
+                auto face = static_cast<CubeFace>(face_id);
+                std::memcpy(
+                    coarse_before->GetFaceDataPointer(face),
+                    level_data->GetFaceDataPointer(face),
+                    face_size);
+            }
+        }
+
+        bool coarsest = level == static_cast<int>(levels.size()) - 1;
+        level_settings.max_steps = coarsest ? settings.coarse_steps : settings.refinement_steps;
+        total_steps += ErodeHeightmap(level_data, level_settings);
+    }
+
+    return total_steps;
+}
+
+void SmoothMap(
+    std::shared_ptr<CubemapData>& map_data,
+    int n_smooths,
+    const std::atomic<bool>* cancel)
+{
+    TERRAIN_PROFILE_SCOPE("SmoothMap");
+    // Faces are swept in place, so each one stays on a single thread
+    int resolution = map_data->GetResolution();
+    CubemapView<float, 1> map(*map_data);
+    auto work = [&map, resolution, n_smooths, cancel](int face_id) {
+        auto face = static_cast<CubeFace>(face_id);
+        TERRAIN_PROFILE_SCOPE_ARG("SmoothMap/Face", face_id);
+        TERRAIN_PROFILE_COUNT(TexelsProcessed, n_smooths * resolution * resolution);
+        for (int k = 0; k < n_smooths && !IsCancelled(cancel); ++k)
+        {
+            for (int j = 1; j < resolution - 1; ++j)
+            {
+                const float* previous_row = map.Row(face, j - 1);
+                float* row = map.Row(face, j);
+                const float* next_row = map.Row(face, j + 1);
+                for (int i = 1; i < resolution - 1; ++i)
+                    row[i] = 0.25f * (row[i + 1] + row[i - 1] + next_row[i] + previous_row[i]);
+            }
+        }
+    };
+    ParallelFor(6, work);
+}
+
+// Height at texel (i, j) of the face plane extended past its edge, read on the face the point falls on
+static float HeightOffFace(CubemapData& height_data, CubeFace face, int i, int j)
+{
+    int resolution = height_data.GetResolution();
+    auto point = CubemapData::CubePoint(CubemapCoordinates{
+        face,
+        (i + 0.5f) / resolution,
+        (j + 0.5f) / resolution });
+    return BilinearInterpolate(height_data, CubemapData::PointCoordinates(point), 0);
+}
+
+void CalculateNormalMap(
+    std::shared_ptr<CubemapData>& height_data,
+    std::shared_ptr<CubemapData>& normal_data,
+    const std::atomic<bool>* cancel)
+{
+    TERRAIN_PROFILE_SCOPE("CalculateNormalMap");
+    int resolution = height_data->GetResolution();
+    auto geometry = SharedCubemapGeometry(resolution);
+    ConstCubemapView<1> heights(*height_data);
+    CubemapView<float, 3> normals(*normal_data);
+    auto work = [&heights, &normals, &geometry, &height_data, resolution, cancel](int row) {
+        if (IsCancelled(cancel))
+            return;
+        auto face = static_cast<CubeFace>(row / resolution);
+        int j = row % resolution;
+        TERRAIN_PROFILE_SCOPE_ARG("CalculateNormalMap/Row", face);
+        TERRAIN_PROFILE_COUNT(TexelsProcessed, resolution);
+        const auto& directions = geometry->Directions(face);
+        const auto& u_tangents = geometry->UTangents(face);
+        const auto& v_tangents = geometry->VTangents(face);
+
+        // Central differences everywhere, past the face border heights come from the neighbouring face.
+        // Only a face's first and last rows reach past it, so one row per thread is enough.
+        thread_local std::vector<float> edge;
+        auto neighbour_row = [&](int neighbour_j) {
+            if (neighbour_j >= 0 && neighbour_j < resolution)
+                return heights.Row(face, neighbour_j);
+            edge.resize(resolution);
+            for (int i = 0; i < resolution; ++i)
+                edge[i] = HeightOffFace(*height_data, face, i, neighbour_j);
+            return static_cast<const float*>(edge.data());
+        };
+        const float* height_row = heights.Row(face, j);
+        const float* previous_row = neighbour_row(j - 1);
+        const float* next_row = neighbour_row(j + 1);
+        float first_previous = HeightOffFace(*height_data, face, -1, j);
+        float last_next = HeightOffFace(*height_data, face, resolution, j);
+        float scale = 0.5f * resolution;
+        glm::vec3* normal_row = normals.Row(face, j);
+        size_t row_start = size_t(j) * resolution;
+        for (int i = 0; i < resolution; ++i)
+        {
+            size_t texel = row_start + i;
+            float previous_height = i > 0 ? height_row[i - 1] : first_previous;
+            float next_height = i + 1 < resolution ? height_row[i + 1] : last_next;
+            float radius_du = scale * (next_height - previous_height);
+            float radius_dv = scale * (next_row[i] - previous_row[i]);
+
+            // Surface r = R d has tangents dR/du d + R dd/du
+            auto direction = directions.Get(texel);
+            float radius = 0.5f + height_row[i];
+            auto eu = radius_du * direction + radius * u_tangents.Get(texel);
+            auto ev = radius_dv * direction + radius * v_tangents.Get(texel);
+
+            auto normal = glm::normalize(-glm::cross(eu, ev));
+            normal_row[i] = 0.5f * (normal + 1.0f);
+        }
+    };
+    ParallelFor(6 * resolution, work);
+}
+
+void GenerateBiomes(
+    std::shared_ptr<CubemapData>& splat_data,
+    const BiomeLookupTable& biome_table,
+    const std::atomic<bool>* cancel)
+{
+    TERRAIN_PROFILE_SCOPE("GenerateBiomes");
+    int resolution = splat_data->GetResolution();
+    auto geometry = SharedCubemapGeometry(resolution);
+    CubemapView<float, 4> splat(*splat_data);
+
+    // Noise at every lattice corner of every face, faces back to back
+    bool interpolate = resolution > climate_lattice_cells;
+    const int stride = climate_lattice_cells + 1;
+    ScratchBuffer lattice_buffer;
+    if (interpolate)
+        lattice_buffer = SharedTerrainArena().AcquireBuffer(2 * 6 * stride * stride);
+    auto* lattice = reinterpret_cast<glm::vec2*>(lattice_buffer.data());
+    if (interpolate)
+    {
+        TERRAIN_PROFILE_SCOPE("GenerateBiomes/ClimateLattice");
+        ParallelFor(6 * stride, [lattice, stride](int row) {
+            auto face = static_cast<CubeFace>(row / stride);
+            int b = row % stride;
+            for (int a = 0; a < stride; ++a)
+                lattice[size_t(row) * stride + a] = ClimateLatticeNoise(face, a, b);
+        });
+    }
+
+    auto work = [&splat, &geometry, &biome_table, lattice, interpolate, stride, resolution, cancel](int row) {
+        if (IsCancelled(cancel))
+            return;
+        auto face = static_cast<CubeFace>(row / resolution);
+        int j = row % resolution;
+        TERRAIN_PROFILE_SCOPE_ARG("GenerateBiomes/Row", face);
+        TERRAIN_PROFILE_COUNT(TexelsProcessed, resolution);
+        const auto& directions = geometry->Directions(face);
+        const glm::vec2* face_lattice = lattice + size_t(face) * stride * stride;
+        glm::vec4* splat_row = splat.Row(face, j);
+        size_t row_start = size_t(j) * resolution;
+        for (int i = 0; i < resolution; ++i)
+        {
+            auto direction = directions.Get(row_start + i);
+            auto noise = interpolate ?
+                InterpolateClimateNoise(face_lattice, 0, 0, stride, i, j, resolution) :
+                ClimateNoise(direction);
+            auto climate = BiomeClimate(direction, noise);
+            splat_row[i] = biome_table.Sample(climate.x, climate.y);
+        }
+    };
+    ParallelFor(6 * resolution, work);
+}
+
+void GenerateTerrainTile(
+    const CubemapTile& tile,
+    int resolution,
+    const TerrainNoiseParameters& parameters,
+    const BiomeLookupTable& biome_table,
+    float* heights,
+    float* normals,
+    float* splat)
+{
+    TERRAIN_PROFILE_SCOPE_ARG("GenerateTerrainTile", tile.face);
+    glm::vec3 seed_offset = NoiseSeedOffset(parameters.seed);
+
+    // Only the climate lattice corners around the tile, GenerateBiomes reads the same values
+    bool interpolate = resolution > climate_lattice_cells;
+    float lattice_scale = float(climate_lattice_cells) / resolution;
+    int a0 = static_cast<int>((tile.i0 + 0.5f) * lattice_scale);
+    int b0 = static_cast<int>((tile.j0 + 0.5f) * lattice_scale);
+    int stride = static_cast<int>((tile.i0 + tile.width - 0.5f) * lattice_scale) + 2 - a0;
+    int lattice_rows = static_cast<int>((tile.j0 + tile.height - 0.5f) * lattice_scale) + 2 - b0;
+    std::vector<glm::vec2> lattice(interpolate ? size_t(stride) * lattice_rows : 0);
+    if (interpolate)
+    {
+        ParallelFor(lattice_rows, [&](int row) {
+            for (int a = 0; a < stride; ++a)
+                lattice[size_t(row) * stride + a] = ClimateLatticeNoise(tile.face, a0 + a, b0 + row);
+        });
+    }
+
+    // Directions are built per texel, the shared geometry would cover every face
+    auto work = [&](int row) {
+        int j = tile.j0 + row;
+        TERRAIN_PROFILE_COUNT(TexelsProcessed, tile.width);
+        for (int x = 0; x < tile.width; ++x)
+        {
+            int i = tile.i0 + x;
+            size_t texel = size_t(row) * tile.width + x;
+            auto point = TexelDirection(tile.face, i, j, resolution);
+
+            if (normals != nullptr)
+            {
+                glm::vec3 normal;
+                heights[texel] = NoiseHeightAndNormal(point, parameters, seed_offset, normal);
+                normals[3 * texel + 0] = normal.x;
+                normals[3 * texel + 1] = normal.y;
+                normals[3 * texel + 2] = normal.z;
+            }
+            else
+            {
+                heights[texel] = NoiseHeight(point, parameters, seed_offset);
+            }
+
+            auto noise = interpolate ?
+                InterpolateClimateNoise(lattice.data(), a0, b0, stride, i, j, resolution) :
+                ClimateNoise(point);
+            auto climate = BiomeClimate(point, noise);
+            auto weights = biome_table.Sample(climate.x, climate.y);
+            splat[4 * texel + 0] = weights.x;
+            splat[4 * texel + 1] = weights.y;
+            splat[4 * texel + 2] = weights.z;
+            splat[4 * texel + 3] = weights.w;
+        }
+    };
+    ParallelFor(tile.height, work);
+}
+
+// Partial sums of one row for the coverage report
+struct MaterialCoverageRow
+{
+    uint32_t over_two = 0;
+    uint32_t differing = 0;
+    float max_dropped = 0.0f;
+    float dropped = 0.0f;
+};
+
+MaterialCoverageReport GenerateMaterialIndexMap(
+    std::shared_ptr<CubemapData>& splat_data,
+    std::shared_ptr<CubemapData>& material_data,
+    const std::atomic<bool>* cancel)
+{
+    TERRAIN_PROFILE_SCOPE("GenerateMaterialIndexMap");
+    const float tolerance = 1.0f / 255.0f;
+    int resolution = splat_data->GetResolution();
+    std::vector<MaterialCoverageRow> rows(6 * resolution);
+    ConstCubemapView<4> splat(*splat_data);
+    CubemapView<float, 3> materials(*material_data);
+    auto work = [&splat, &materials, &rows, tolerance, resolution, cancel](int row) {
+        if (IsCancelled(cancel))
+            return;
+        auto face = static_cast<CubeFace>(row / resolution);
+        int j = row % resolution;
+        TERRAIN_PROFILE_SCOPE_ARG("GenerateMaterialIndexMap/Row", face);
+        TERRAIN_PROFILE_COUNT(TexelsProcessed, resolution);
+        const glm::vec4* splat_row = splat.Row(face, j);
+        glm::vec3* material_row = materials.Row(face, j);
+
+        // Ranks and selects are branch free, ties keep the lower channel first
+        MaterialCoverageRow coverage;
+        for (int i = 0; i < resolution; ++i)
+        {
+            const glm::vec4& weights = splat_row[i];
+            float first_index = 0.0f;
+            float second_index = 0.0f;
+            float first_weight = 0.0f;
+            float second_weight = 0.0f;
+            float total = 0.0f;
+            uint32_t non_zero = 0;
+            for (int c = 0; c < 4; ++c)
+            {
+                int rank = 0;
+                for (int d = 0; d < 4; ++d)
+                    rank += (weights[d] > weights[c]) | ((weights[d] == weights[c]) & (d < c));
+                float is_first = float(rank == 0);
+                float is_second = float(rank == 1);
+                first_index += is_first * c;
+                second_index += is_second * c;
+                first_weight += is_first * weights[c];
+                second_weight += is_second * weights[c];
+                total += weights[c];
+                non_zero += weights[c] > 0.0f;
+            }
+
+            // The epsilon makes an all zero texel keep the first material and drop nothing
+            const float epsilon = 1.0e-20f;
+            float kept = first_weight + second_weight;
+            float dropped = (total - kept) / (total + epsilon);
+            material_row[i] = glm::vec3(
+                first_index / 3.0f,
+                second_index / 3.0f,
+                (first_weight + epsilon) / (kept + epsilon));
+
+            coverage.over_two += non_zero > 2;
+            coverage.differing += dropped > tolerance;
+            coverage.max_dropped = glm::max(coverage.max_dropped, dropped);
+            coverage.dropped += dropped;
+        }
+        rows[row] = coverage;
+    };
+    ParallelFor(6 * resolution, work);
+
+    MaterialCoverageReport report;
+    report.texels = 6 * uint64_t(resolution) * resolution;
+    double dropped = 0.0;
+    for (const auto& coverage : rows)
+    {
+        report.texels_over_two += coverage.over_two;
+        report.texels_differing += coverage.differing;
+        report.max_dropped_weight = glm::max(report.max_dropped_weight, double(coverage.max_dropped));
+        dropped += coverage.dropped;
+    }
+    report.mean_dropped_weight = report.texels > 0 ? dropped / report.texels : 0.0;
+    return report;
+}
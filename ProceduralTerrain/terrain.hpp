@@ -2,199 +2,130 @@
 #define TERRAIN_HPP
 #include <Merlin/Render/cubemap.hpp>
 #include <Merlin/Render/cubemap_data.hpp>
-#include <thread>
-#include "noise3d.hpp"
-#include "cube_sphere.hpp"
+#include <atomic>
+#include <memory>
+#include "biome.hpp"
+#include "erosion.hpp"
 
+using namespace Merlin;
 
-void GenerateNoiseHeightmap(std::shared_ptr<CubemapData>& height_data)
-{
-    std::vector<std::thread> threads;
-    for (int face_id = Merlin::CubeFace::Begin; face_id < Merlin::CubeFace::End; face_id++)
-    {
-        auto work = [height_data, face_id]() {
-            auto face = static_cast<Merlin::CubeFace>(face_id);
-            for (int j = 0; j < height_data->GetResolution(); ++j)
-            {
-                for (int i = 0; i < height_data->GetResolution(); ++i)
-                {
-                    auto point = Merlin::CubemapData::CubePoint(height_data->GetPixelCoordinates(face, i, j));
-                    point = glm::normalize(point);
-
-                    float ridge_noise = 1.00f * FractalRidgeNoise(point, 2.0f, 4, 0.5f, 2.0f);
-                    float smooth_noise = 0.05f * FractalNoise(point, 4.0f, 4, 0.7f, 2.0f);
-                    float blend = 0.5f * (glm::simplex(1.0f * point) + 1.0f);
-                    float noise = blend * ridge_noise + (1.0 - blend) * smooth_noise;
-
-                    height_data->GetPixel(face, i, j, 0) = 0.5 + 0.03 * ridge_noise;
-                }
-            }
-        };
-        threads.emplace_back(work);
-    }
-    for (auto& thread : threads)
-        thread.join();
-}
 
-void ErodeHeightmap(std::shared_ptr<CubemapData>& height_data)
+struct TerrainNoiseParameters
 {
-    float grid_spacing = 1.0f / height_data->GetResolution();
-    ErosionParameters erosion_params;
-    erosion_params.concentration_factor = 3.0f;
-    erosion_params.erosion_time = 0.5f;
-    erosion_params.evaporation_time = 1.0f;
-    erosion_params.friction_time = 0.5;
-    erosion_params.particle_start_volume = 0.8f * grid_spacing * grid_spacing;
-
-    int n_particles = 1000;
-    int n_steps = 10000;
-    std::vector<ErosionParticle> particles(n_particles);
-    for (auto& p : particles) { InitializeParticle(p, erosion_params); }
-    for (int i = 0; i < n_steps; ++i)
-        for (auto& p : particles)
-            UpdateParticle(p, *height_data, erosion_params);
-}
-
-void SmoothMap(std::shared_ptr<CubemapData>& map_data, int n_smooths)
-{
-    std::vector<std::thread> threads;
-    threads.clear();
-    for (int face_id = CubeFace::Begin; face_id < CubeFace::End; face_id++)
-    {
-        auto work = [map_data, face_id, n_smooths]() {
-            auto face = static_cast<CubeFace>(face_id);
-            for (int k = 0; k < n_smooths; ++k)
-            {
-                for (int j = 1; j < map_data->GetResolution() - 1; ++j)
-                {
-                    for (int i = 1; i < map_data->GetResolution() - 1; ++i)
-                    {
-                        float average = 0.25f * (
-                            map_data->GetPixel(face, i + 1, j, 0) +
-                            map_data->GetPixel(face, i - 1, j, 0) +
-                            map_data->GetPixel(face, i, j + 1, 0) +
-                            map_data->GetPixel(face, i, j - 1, 0));
-                        map_data->GetPixel(face, i, j, 0) = average;
-                    }
-                }
-            }
-        };
-        threads.emplace_back(work);
-    }
-    for (auto& thread : threads)
-        thread.join();
+    uint32_t seed = 0;
+    float base_frequency = 2.0f;
+    int octaves = 4;
+    float persistence = 0.5f;
+    float frequency_multiplier = 2.0f;
+    float height_scale = 0.03f;
+};
+
+
+/*
+Passes take an optional cancel flag for background regeneration. It is
+polled once per row tile, or once per face sweep and erosion step, and the
+remaining work is skipped once it is set. Output of a cancelled pass is
+incomplete and should be discarded.
+*/
+void GenerateNoiseHeightmap(
+    std::shared_ptr<CubemapData>& height_data,
+    const TerrainNoiseParameters& parameters = TerrainNoiseParameters(),
+    const std::atomic<bool>* cancel = nullptr);
+
+/*
+Heightmap and exact normals in a single pass using analytic noise gradients.
+CalculateNormalMap is only needed once erosion or smoothing changes the heights.
+*/
+void GenerateNoiseHeightmap(
+    std::shared_ptr<CubemapData>& height_data,
+    std::shared_ptr<CubemapData>& normal_data,
+    const TerrainNoiseParameters& parameters = TerrainNoiseParameters(),
+    const std::atomic<bool>* cancel = nullptr);
+
+// Returns the number of erosion steps taken, including any resumed from a checkpoint
+int ErodeHeightmap(
+    std::shared_ptr<CubemapData>& height_data,
+    const ErosionRunSettings& settings = ErosionRunSettings());
+
+// Resolutions of the levels ErodeHeightmapMultigrid erodes, finest first
+std::vector<int> MultigridLevelResolutions(
+    int resolution,
+    const MultigridErosionSettings& settings = MultigridErosionSettings());
 
-}
+// Coarse to fine erosion, returns the number of steps taken over all levels
+int ErodeHeightmapMultigrid(
+    std::shared_ptr<CubemapData>& height_data,
+    const MultigridErosionSettings& settings = MultigridErosionSettings());
+
+void SmoothMap(
+    std::shared_ptr<CubemapData>& map_data,
+    int n_smooths,
+    const std::atomic<bool>* cancel = nullptr);
 
 void CalculateNormalMap(
     std::shared_ptr<CubemapData>& height_data,
-    std::shared_ptr<CubemapData>& normal_data)
-{
-    std::vector<std::thread> threads;
+    std::shared_ptr<CubemapData>& normal_data,
+    const std::atomic<bool>* cancel = nullptr);
 
-    for (int face_id = CubeFace::Begin; face_id < CubeFace::End; face_id++)
-    {
-        auto work = [height_data, normal_data, face_id]() {
-            auto face = static_cast<CubeFace>(face_id);
-            for (int j = 0; j < height_data->GetResolution(); ++j)
-            {
-                for (int i = 0; i < height_data->GetResolution(); ++i)
-                {
-                    auto point = CubemapData::CubePoint(
-                        height_data->GetPixelCoordinates(face, i, j));
-                    point = glm::normalize(point);
-
-                    auto eu = SphereHeightmapUTangent(point, *height_data);
-                    auto ev = SphereHeightmapVTangent(point, *height_data);
-
-                    auto normal = -glm::cross(eu, ev);
-                    normal = glm::normalize(normal);
-                    normal = 0.5f * (normal + 1.0f);
-                    normal_data->GetPixel(face, i, j, 0) = normal.x;
-                    normal_data->GetPixel(face, i, j, 1) = normal.y;
-                    normal_data->GetPixel(face, i, j, 2) = normal.z;
-                }
-            }
-        };
-        threads.emplace_back(work);
-    }
-    for (auto& thread : threads)
-        thread.join();
-}
+// Above 128 texels per face edge the climate noise is interpolated from a coarse lattice
+void GenerateBiomes(
+    std::shared_ptr<CubemapData>& splat_data,
+    const BiomeLookupTable& biome_table,
+    const std::atomic<bool>* cancel = nullptr);
 
-void GenerateBiomes(std::shared_ptr<CubemapData>& splat_data)
+// Rectangle of texels on one cubemap face
+struct CubemapTile
 {
-    std::vector<std::thread> threads;
-    for (int face_id = CubeFace::Begin; face_id < CubeFace::End; face_id++)
+    CubeFace face = CubeFace::Begin;
+    int i0 = 0;
+    int j0 = 0;
+    int width = 0;
+    int height = 0;
+};
+
+/*
+Noise heights, biome splat weights and, unless normals is null, exact
+normals for one tile of a cubemap with the given resolution. Texels match
+GenerateNoiseHeightmap and GenerateBiomes, so tiles generated apart can be
+assembled into the same maps. Outputs hold the tile rows back to back with
+channels interleaved.
+*/
+void GenerateTerrainTile(
+    const CubemapTile& tile,
+    int resolution,
+    const TerrainNoiseParameters& parameters,
+    const BiomeLookupTable& biome_table,
+    float* heights,
+    float* normals,
+    float* splat);
+
+
+// How closely the top two materials reproduce the full splat blend
+struct MaterialCoverageReport
+{
+    uint64_t texels = 0;
+    // Texels with more than two non-zero splat weights
+    uint64_t texels_over_two = 0;
+    // Texels whose dropped weight would change an 8 bit blend
+    uint64_t texels_differing = 0;
+    double max_dropped_weight = 0.0;
+    double mean_dropped_weight = 0.0;
+
+    inline double DifferingFraction() const
     {
-        auto work = [splat_data, face_id]() {
-            auto face = static_cast<CubeFace>(face_id);
-            for (int j = 0; j < splat_data->GetResolution(); ++j)
-            {
-                for (int i = 0; i < splat_data->GetResolution(); ++i)
-                {
-                    auto point = CubemapData::CubePoint(splat_data->GetPixelCoordinates(face, i, j));
-                    point = glm::normalize(point);
-
-                    float cosT = glm::dot(point, glm::vec3(0.0, 1.0, 0.0));
-                    float T = glm::acos(cosT);
-                    float sin2T = glm::sin(2.0f * T);
-
-                    float temperature = 1.0f - cosT * cosT;
-                    temperature += 0.1f * SmoothNoise(5.0f * point + glm::vec3(0.0, 15.0, 0.0));
-                    temperature = glm::clamp(temperature, 0.0f, 1.0f);
-
-
-                    float rainfall = sin2T * sin2T;
-                    rainfall += 0.4f * SmoothNoise(3.0f * point + glm::vec3(0.0, 15.0, 0.0));
-                    rainfall = glm::clamp(rainfall, 0.0f, 1.0f);
-
-                    float tundra = glm::clamp(0.5f - (temperature - 0.3f) / 0.1f, 0.0f, 1.0f);
-
-                    float shrub = (1.0f - tundra);
-                    float grass = (1.0f - tundra);
-                    float forest = (1.0f - tundra);
-                    if (rainfall < 0.1)
-                    {
-                        grass *= 0.0f;
-                        forest *= 0.0f;
-                    }
-                    else if (rainfall < 0.3)
-                    {
-                        float blend = 0.5f - (rainfall - 0.2f) / (2.0f * 0.1f);
-                        shrub *= blend;
-                        grass *= (1.0 - blend);
-                        forest *= 0.0;
-                    }
-                    else if (rainfall < 0.5)
-                    {
-                        shrub *= 0.0f;
-                        forest *= 0.0f;
-                    }
-                    else if (rainfall < 0.7f)
-                    {
-                        float blend = 0.5f - (rainfall - 0.6f) / (2.0f * 0.1f);
-                        shrub *= 0.0f;
-                        grass *= blend;
-                        forest *= (1.0 - blend);
-                    }
-                    else
-                    {
-                        shrub *= 0.0f;
-                        grass *= 0.0f;
-                    }
-
-                    splat_data->GetPixel(face, i, j, 0) = tundra;
-                    splat_data->GetPixel(face, i, j, 1) = shrub;
-                    splat_data->GetPixel(face, i, j, 2) = grass;
-                    splat_data->GetPixel(face, i, j, 3) = forest;
-                }
-            }
-        };
-        threads.emplace_back(work);
+        return texels > 0 ? double(texels_differing) / texels : 0.0;
     }
-    for (auto& thread : threads)
-        thread.join();
-}
-
-#endif
\ No newline at end of file
+};
+
+/*
+Compact material map for the two material shader path.
+Channel 0 and 1 hold the dominant and second material index as index / 3,
+channel 2 the dominant material's share once the two are renormalized.
+The splat map is left as it is for the four material path.
+*/
+MaterialCoverageReport GenerateMaterialIndexMap(
+    std::shared_ptr<CubemapData>& splat_data,
+    std::shared_ptr<CubemapData>& material_data,
+    const std::atomic<bool>* cancel = nullptr);
+
+#endif
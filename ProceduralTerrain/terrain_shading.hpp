@@ -0,0 +1,87 @@
+#ifndef TERRAIN_SHADING_HPP
+#define TERRAIN_SHADING_HPP
+#include "uniform_batch.hpp"
+
+
+// Artist facing settings for the cube sphere shader
+struct TerrainShadingSettings
+{
+    float texture_scales[4]{ 2.5f, 2.5f, 2.5f, 2.5f };
+    float water_scale = 0.08f;
+    float water_speed = 0.1f;
+    float water_level = 0.5f;
+    float water_depth_scale = 0.017f;
+    glm::vec3 water_shallow_color{ 0.0f / 256.0f, 64.0f / 256.0f, 89.0f / 256.0f };
+    glm::vec3 water_deep_color{ 0.0f / 256.0f, 28.0f / 256.0f, 34.0f / 256.0f };
+    float shadow_softness = 0.04f;
+    float ambient_occlusion = 1.0f;
+    bool two_material_splat = true;
+};
+
+
+/*
+Uniform batch for the terrain material.
+Uniforms are registered once and set by handle, their locations are
+looked up on the first Flush to each shader program, and a single Flush
+per frame uploads whatever changed by location.
+*/
+class TerrainShadingUniforms
+{
+    UniformBatch m_batch;
+    UniformBatch::Handle m_time;
+    UniformBatch::Handle m_water_shallow_color;
+    UniformBatch::Handle m_water_deep_color;
+    UniformBatch::Handle m_water_level;
+    UniformBatch::Handle m_water_depth_scale;
+    UniformBatch::Handle m_water_speed;
+    UniformBatch::Handle m_water_scale;
+    UniformBatch::Handle m_texture_scales[4];
+    UniformBatch::Handle m_shadow_softness;
+    UniformBatch::Handle m_ambient_occlusion;
+    UniformBatch::Handle m_two_material_splat;
+
+public:
+    TerrainShadingUniforms(const TerrainShadingSettings& settings = {})
+    {
+        m_time = m_batch.AddFloat("time", 0.0f);
+        m_water_shallow_color = m_batch.AddFloat3("u_water_shallow_color", settings.water_shallow_color);
+        m_water_deep_color = m_batch.AddFloat3("u_water_deep_color", settings.water_deep_color);
+        m_water_level = m_batch.AddFloat("u_water_level", settings.water_level);
+        m_water_depth_scale = m_batch.AddFloat("u_water_depth_scale", settings.water_depth_scale);
+        m_water_speed = m_batch.AddFloat("u_water_speed", settings.water_speed);
+        m_water_scale = m_batch.AddFloat("u_water_scale", settings.water_scale);
+        for (int k = 0; k < 4; ++k)
+        {
+            m_texture_scales[k] = m_batch.AddFloat(
+                "u_terrain_texture_scales[" + std::to_string(k) + "]",
+                settings.texture_scales[k]);
+        }
+        m_shadow_softness = m_batch.AddFloat("u_shadow_softness", settings.shadow_softness);
+        m_ambient_occlusion = m_batch.AddFloat("u_ambient_occlusion", settings.ambient_occlusion);
+        // The batch only carries floats, so the toggle goes up as 0 or 1
+        m_two_material_splat = m_batch.AddFloat("u_two_material_splat", settings.two_material_splat ? 1.0f : 0.0f);
+    }
+
+    inline void SetTime(float time) { m_batch.Set(m_time, time); }
+
+    void SetSettings(const TerrainShadingSettings& settings)
+    {
+        m_batch.Set(m_water_shallow_color, settings.water_shallow_color);
+        m_batch.Set(m_water_deep_color, settings.water_deep_color);
+        m_batch.Set(m_water_level, settings.water_level);
+        m_batch.Set(m_water_depth_scale, settings.water_depth_scale);
+        m_batch.Set(m_water_speed, settings.water_speed);
+        m_batch.Set(m_water_scale, settings.water_scale);
+        for (int k = 0; k < 4; ++k)
+            m_batch.Set(m_texture_scales[k], settings.texture_scales[k]);
+        m_batch.Set(m_shadow_softness, settings.shadow_softness);
+        m_batch.Set(m_ambient_occlusion, settings.ambient_occlusion);
+        m_batch.Set(m_two_material_splat, settings.two_material_splat ? 1.0f : 0.0f);
+    }
+
+    inline void MarkAllDirty() { m_batch.MarkAllDirty(); }
+
+    inline int Flush(UniformTarget& target) { return m_batch.Flush(target); }
+};
+
+#endif
@@ -0,0 +1,187 @@
+#ifndef UNIFORM_BATCH_HPP
+#define UNIFORM_BATCH_HPP
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <glm/glm.hpp>
+
+
+/*
+Destination for uniform uploads.
+Names are resolved to locations once per shader program and values are
+uploaded by location. The program id changes whenever earlier locations
+stop being valid, e.g. when the shader is relinked or the material is
+replaced. The editor forwards to a Merlin material, headless tools use
+the recording backend below.
+*/
+class UniformTarget
+{
+public:
+    virtual ~UniformTarget() = default;
+
+    virtual uint64_t GetProgramId() const = 0;
+
+    // -1 when the program has no uniform of that name
+    virtual int GetUniformLocation(const std::string& name) = 0;
+
+    virtual void SetUniformFloat(int location, float value) = 0;
+
+    virtual void SetUniformFloat3(int location, const glm::vec3& value) = 0;
+};
+
+
+/*
+Null render backend, keeps the last value per location and counts uploads
+so per frame CPU cost can be measured without a GPU. Every name gets a
+location the first time it is looked up, and every target is its own
+program.
+*/
+class RecordingUniformTarget : public UniformTarget
+{
+    uint64_t m_program_id;
+    std::unordered_map<std::string, int> m_locations;
+    std::vector<std::string> m_names;
+    std::vector<glm::vec3> m_values;
+    uint64_t m_upload_count = 0;
+
+    static uint64_t NextProgramId()
+    {
+        static std::atomic<uint64_t> next_program_id{ 1 };
+        return next_program_id++;
+    }
+
+public:
+    RecordingUniformTarget() :
+        m_program_id(NextProgramId())
+    {
+    }
+
+    uint64_t GetProgramId() const override { return m_program_id; }
+
+    int GetUniformLocation(const std::string& name) override
+    {
+        auto inserted = m_locations.emplace(name, static_cast<int>(m_names.size()));
+        if (inserted.second)
+        {
+            m_names.push_back(name);
+            m_values.push_back(glm::vec3(0.0f));
+        }
+        return inserted.first->second;
+    }
+
+    void SetUniformFloat(int location, float value) override
+    {
+        m_values[location] = glm::vec3(value, 0.0f, 0.0f);
+        m_upload_count++;
+    }
+
+    void SetUniformFloat3(int location, const glm::vec3& value) override
+    {
+        m_values[location] = value;
+        m_upload_count++;
+    }
+
+    inline uint64_t GetUploadCount() const { return m_upload_count; }
+
+    // Last value uploaded to name, zero if it never was
+    glm::vec3 GetValue(const std::string& name) const
+    {
+        auto location = m_locations.find(name);
+        return location == m_locations.end() ? glm::vec3(0.0f) : m_values[location->second];
+    }
+};
+
+
+/*
+Uniform values registered once and addressed by handle.
+Set only marks an entry dirty when its value changes and Flush uploads
+the dirty entries by location, so unchanged settings cost nothing per
+frame. Locations are looked up on the first Flush to a program and again
+with every value uploaded whenever the target's program changes.
+*/
+class UniformBatch
+{
+    struct Entry
+    {
+        std::string name;
+        int components;
+        int location;
+        glm::vec3 value;
+        bool dirty;
+    };
+    std::vector<Entry> m_entries;
+    bool m_resolved = false;
+    uint64_t m_program_id = 0;
+
+public:
+    using Handle = int;
+
+    Handle AddFloat(const std::string& name, float value)
+    {
+        m_entries.push_back(Entry{ name, 1, -1, glm::vec3(value, 0.0f, 0.0f), true });
+        m_resolved = false;
+        return static_cast<Handle>(m_entries.size() - 1);
+    }
+
+    Handle AddFloat3(const std::string& name, const glm::vec3& value)
+    {
+        m_entries.push_back(Entry{ name, 3, -1, value, true });
+        m_resolved = false;
+        return static_cast<Handle>(m_entries.size() - 1);
+    }
+
+    inline void Set(Handle handle, float value)
+    {
+        auto& entry = m_entries[handle];
+        entry.dirty |= entry.value.x != value;
+        entry.value.x = value;
+    }
+
+    inline void Set(Handle handle, const glm::vec3& value)
+    {
+        auto& entry = m_entries[handle];
+        entry.dirty |= entry.value != value;
+        entry.value = value;
+    }
+
+    // Forces a full upload on the next Flush
+    void MarkAllDirty()
+    {
+        for (auto& entry : m_entries)
+            entry.dirty = true;
+    }
+
+    // Returns the number of uniforms uploaded
+    int Flush(UniformTarget& target)
+    {
+        uint64_t program_id = target.GetProgramId();
+        if (!m_resolved || program_id != m_program_id)
+        {
+            for (auto& entry : m_entries)
+                entry.location = target.GetUniformLocation(entry.name);
+            MarkAllDirty();
+            m_resolved = true;
+            m_program_id = program_id;
+        }
+
+        int upload_count = 0;
+        for (auto& entry : m_entries)
+        {
+            if (!entry.dirty)
+                continue;
+            entry.dirty = false;
+            if (entry.location < 0)
+                continue;
+            if (entry.components == 1)
+                target.SetUniformFloat(entry.location, entry.value.x);
+            else
+                target.SetUniformFloat3(entry.location, entry.value);
+            upload_count++;
+        }
+        return upload_count;
+    }
+};
+
+#endif